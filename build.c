@@ -395,6 +395,12 @@ int main()
         const String256 src_path = src[i];
         ASSERT(str_begins_with_cstr(src_path, "src\\"), "Expected 'src\\' in beginning of src file '%s'", src[i].s);
 
+        // Headless linux platform layer. Built by build_linux.sh.
+        if(str_begins_with_cstr(src_path, "src\\platform_linux\\"))
+        {
+            continue;
+        }
+
         if(str_ends_with_cstr(src_path, ".c"))
         {
             ASSERT(num_c_files <= MAX_SRC, "c_files overflow.");
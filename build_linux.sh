@@ -0,0 +1,39 @@
+#!/bin/sh
+
+################################################################################
+#
+# sh build_linux.sh
+#
+# Headless Linux build. No window, renderer or input; see src/platform_linux.
+#   engine_headless [num_frames]           Runs tick_engine as fast as possible.
+#   engine_bench [num_frames] [scenario]   Simulation benchmark, one JSON line per scenario.
+# The win32 build (build.c) skips src/platform_linux.
+#
+################################################################################
+
+set -e
+
+CC=${CC:-cc}
+
+# No fp contraction so the AVX2 and scalar kernels round identically.
+COMMON_COMPILE_FLAGS="-std=gnu17 -Wall -Wextra -Werror -march=skylake -ffp-contract=off -pthread -Isrc"
+DEBUG_COMPILE_FLAGS="-O0 -g -DDEBUG"
+RELEASE_COMPILE_FLAGS="-O2 -g"
+
+ENGINE_SRC="src/bullet_compact.c src/engine.c src/job_system.c src/npc.c src/path_find.c src/wall_grid.c src/platform_linux/platform_linux_core.c"
+
+build()
+{
+    name=$1
+    flags=$2
+
+    deploy_dir=build/deploy_$name
+    mkdir -p "$deploy_dir"
+
+    echo "Building '$name'"
+    $CC $COMMON_COMPILE_FLAGS $flags -o "$deploy_dir/engine_headless" $ENGINE_SRC src/platform_linux/platform_linux_main.c
+    $CC $COMMON_COMPILE_FLAGS $flags -o "$deploy_dir/engine_bench" $ENGINE_SRC src/platform_linux/platform_linux_bench.c
+}
+
+build gcc_debug "$DEBUG_COMPILE_FLAGS"
+build gcc_release "$RELEASE_COMPILE_FLAGS"
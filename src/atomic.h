@@ -0,0 +1,94 @@
+#pragma once
+
+#include "common.h"
+
+// Minimal atomics for the job system. The win32 build has no C runtime, so use compiler intrinsics rather than
+// stdatomic.h. Loads acquire, stores release, read-modify-writes and atomic_fence are sequentially consistent.
+
+#ifdef _MSC_VER
+
+#include <intrin.h>
+
+static inline s64 atomic_load_s64(const volatile s64* p)
+{
+    const s64 v = *p;
+    _ReadWriteBarrier();
+    return v;
+}
+
+static inline void atomic_store_s64(volatile s64* p, const s64 v)
+{
+    _ReadWriteBarrier();
+    *p = v;
+}
+
+static inline u64 atomic_load_u64(const volatile u64* p)
+{
+    const u64 v = *p;
+    _ReadWriteBarrier();
+    return v;
+}
+
+static inline void atomic_store_u64(volatile u64* p, const u64 v)
+{
+    _ReadWriteBarrier();
+    *p = v;
+}
+
+// Returns 1 if '*p' was 'expected' and is now 'desired'.
+static inline u8 atomic_cas_s64(volatile s64* p, const s64 expected, const s64 desired)
+{
+    return _InterlockedCompareExchange64((volatile long long*)p, desired, expected) == expected;
+}
+
+// Returns the new value.
+static inline s64 atomic_add_s64(volatile s64* p, const s64 v)
+{
+    return _InterlockedExchangeAdd64((volatile long long*)p, v) + v;
+}
+
+static inline void atomic_fence()
+{
+    _mm_mfence();
+}
+
+#else
+
+static inline s64 atomic_load_s64(const volatile s64* p)
+{
+    return __atomic_load_n(p, __ATOMIC_ACQUIRE);
+}
+
+static inline void atomic_store_s64(volatile s64* p, const s64 v)
+{
+    __atomic_store_n(p, v, __ATOMIC_RELEASE);
+}
+
+static inline u64 atomic_load_u64(const volatile u64* p)
+{
+    return __atomic_load_n(p, __ATOMIC_ACQUIRE);
+}
+
+static inline void atomic_store_u64(volatile u64* p, const u64 v)
+{
+    __atomic_store_n(p, v, __ATOMIC_RELEASE);
+}
+
+// Returns 1 if '*p' was 'expected' and is now 'desired'.
+static inline u8 atomic_cas_s64(volatile s64* p, s64 expected, const s64 desired)
+{
+    return __atomic_compare_exchange_n(p, &expected, desired, 0, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+}
+
+// Returns the new value.
+static inline s64 atomic_add_s64(volatile s64* p, const s64 v)
+{
+    return __atomic_add_fetch(p, v, __ATOMIC_SEQ_CST);
+}
+
+static inline void atomic_fence()
+{
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+}
+
+#endif
@@ -0,0 +1,156 @@
+#include "bullet_compact.h"
+
+// LEFT_PACK_INDICES[mask] holds, in byte j, the lane of the j-th set bit of the 8-bit mask. Unused bytes are 0.
+#define LEFT_PACK_POPCOUNT8(x) \
+    (((x) & 1) + (((x) >> 1) & 1) + (((x) >> 2) & 1) + (((x) >> 3) & 1) + \
+     (((x) >> 4) & 1) + (((x) >> 5) & 1) + (((x) >> 6) & 1) + (((x) >> 7) & 1))
+#define LEFT_PACK_LANE(m, k) \
+    ((u64)(((m) >> (k)) & 1) * ((u64)(k) << (8 * LEFT_PACK_POPCOUNT8((m) & ((1U << (k)) - 1)))))
+#define LEFT_PACK(m) \
+    (LEFT_PACK_LANE(m, 1) | LEFT_PACK_LANE(m, 2) | LEFT_PACK_LANE(m, 3) | LEFT_PACK_LANE(m, 4) | \
+     LEFT_PACK_LANE(m, 5) | LEFT_PACK_LANE(m, 6) | LEFT_PACK_LANE(m, 7))
+#define LEFT_PACK_4(m) LEFT_PACK((m) + 0), LEFT_PACK((m) + 1), LEFT_PACK((m) + 2), LEFT_PACK((m) + 3)
+#define LEFT_PACK_16(m) LEFT_PACK_4((m) + 0), LEFT_PACK_4((m) + 4), LEFT_PACK_4((m) + 8), LEFT_PACK_4((m) + 12)
+#define LEFT_PACK_64(m) LEFT_PACK_16((m) + 0), LEFT_PACK_16((m) + 16), LEFT_PACK_16((m) + 32), LEFT_PACK_16((m) + 48)
+
+static const u64 LEFT_PACK_INDICES[256] =
+{
+    LEFT_PACK_64(0), LEFT_PACK_64(64), LEFT_PACK_64(128), LEFT_PACK_64(192)
+};
+_Static_assert(LEFT_PACK(0xA5) == 0x07050200ULL, "Bad left pack table.");
+
+#define BULLET_COMPACT_FRAME_DT ((f32)FRAME_DURATION_NS * (1.0f / 1000000000.0f))
+
+// Compacts the bullets in [i_src, num_bullets) to i_dst onwards. Returns the new bullet count.
+static u32 compact_bullet_range(
+    struct GameState* next_game_state,
+    const struct GameState* prev_game_state,
+    const u8* bullet_is_dead,
+    u32 i_src,
+    const u32 num_bullets,
+    u32 i_dst)
+{
+    for(; i_src < num_bullets; i_src++)
+    {
+        if(!bullet_is_dead[i_src])
+        {
+            next_game_state->bullet_vel_x[i_dst] = prev_game_state->bullet_vel_x[i_src];
+            next_game_state->bullet_vel_y[i_dst] = prev_game_state->bullet_vel_y[i_src];
+            next_game_state->bullet_pos_x[i_dst] = next_game_state->bullet_pos_x[i_src];
+            next_game_state->bullet_pos_y[i_dst] = next_game_state->bullet_pos_y[i_src];
+            next_game_state->bullet_prev_pos_x[i_dst] = prev_game_state->bullet_pos_x[i_src];
+            next_game_state->bullet_prev_pos_y[i_dst] = prev_game_state->bullet_pos_y[i_src];
+            next_game_state->bullet_wall_hit_time[i_dst] = prev_game_state->bullet_wall_hit_time[i_src] - BULLET_COMPACT_FRAME_DT;
+            next_game_state->bullet_team_id[i_dst] = prev_game_state->bullet_team_id[i_src];
+            i_dst++;
+        }
+    }
+    return i_dst;
+}
+
+u32 compact_bullets_scalar(
+    struct GameState* next_game_state,
+    const struct GameState* prev_game_state,
+    const u8* bullet_is_dead,
+    const u32 num_bullets)
+{
+    return compact_bullet_range(next_game_state, prev_game_state, bullet_is_dead, 0, num_bullets, 0);
+}
+
+// Stores all 8 lanes, so 'dst' needs 8 writable floats. Loads before storing, so 'dst' may trail 'src' in place.
+static inline void left_pack_f32_avx2(f32* dst, const f32* src, const __m256i lanes)
+{
+    _mm256_storeu_ps(dst, _mm256_permutevar8x32_ps(_mm256_loadu_ps(src), lanes));
+}
+
+u32 compact_bullets_avx2(
+    struct GameState* next_game_state,
+    const struct GameState* prev_game_state,
+    const u8* bullet_is_dead,
+    const u32 num_bullets)
+{
+    // Survivors never move up, so the full-width stores stay below i_src + 8 <= num_bullets and never clobber a
+    // position that has not been loaded yet.
+    const __m256 frame_dt8 = _mm256_set1_ps(BULLET_COMPACT_FRAME_DT);
+    u32 i_dst = 0;
+    u32 i_src = 0;
+    for(; i_src + 8 <= num_bullets; i_src += 8)
+    {
+        const __m128i is_dead8 = _mm_loadl_epi64((const __m128i*)(bullet_is_dead + i_src));
+        const u32 alive_mask = (u32)_mm_movemask_epi8(_mm_cmpeq_epi8(is_dead8, _mm_setzero_si128())) & 0xFF;
+        if(alive_mask == 0)
+        {
+            continue;
+        }
+
+        const __m128i lanes8 = _mm_cvtsi64_si128((s64)LEFT_PACK_INDICES[alive_mask]);
+        const __m256i lanes = _mm256_cvtepu8_epi32(lanes8);
+        left_pack_f32_avx2(next_game_state->bullet_vel_x + i_dst, prev_game_state->bullet_vel_x + i_src, lanes);
+        left_pack_f32_avx2(next_game_state->bullet_vel_y + i_dst, prev_game_state->bullet_vel_y + i_src, lanes);
+        left_pack_f32_avx2(next_game_state->bullet_pos_x + i_dst, next_game_state->bullet_pos_x + i_src, lanes);
+        left_pack_f32_avx2(next_game_state->bullet_pos_y + i_dst, next_game_state->bullet_pos_y + i_src, lanes);
+        left_pack_f32_avx2(next_game_state->bullet_prev_pos_x + i_dst, prev_game_state->bullet_pos_x + i_src, lanes);
+        left_pack_f32_avx2(next_game_state->bullet_prev_pos_y + i_dst, prev_game_state->bullet_pos_y + i_src, lanes);
+        const __m256 wall_hit_time = _mm256_loadu_ps(prev_game_state->bullet_wall_hit_time + i_src);
+        _mm256_storeu_ps(
+            next_game_state->bullet_wall_hit_time + i_dst,
+            _mm256_sub_ps(_mm256_permutevar8x32_ps(wall_hit_time, lanes), frame_dt8));
+
+        const __m128i team_id = _mm_loadl_epi64((const __m128i*)(prev_game_state->bullet_team_id + i_src));
+        _mm_storel_epi64((__m128i*)(next_game_state->bullet_team_id + i_dst), _mm_shuffle_epi8(team_id, lanes8));
+
+        i_dst += (u32)_mm_popcnt_u32(alive_mask);
+    }
+
+    return compact_bullet_range(next_game_state, prev_game_state, bullet_is_dead, i_src, num_bullets, i_dst);
+}
+
+#ifdef __AVX512F__
+static inline void left_pack_f32_avx512(f32* dst, const f32* src, const __mmask16 alive_mask)
+{
+    // Compress into a register and store that; compressing straight to memory is slow on some cpus.
+    _mm512_storeu_ps(dst, _mm512_maskz_compress_ps(alive_mask, _mm512_loadu_ps(src)));
+}
+
+u32 compact_bullets_avx512(
+    struct GameState* next_game_state,
+    const struct GameState* prev_game_state,
+    const u8* bullet_is_dead,
+    const u32 num_bullets)
+{
+    // Same in place argument as compact_bullets_avx2, 16 lanes wide.
+    const __m512 frame_dt16 = _mm512_set1_ps(BULLET_COMPACT_FRAME_DT);
+    u32 i_dst = 0;
+    u32 i_src = 0;
+    for(; i_src + 16 <= num_bullets; i_src += 16)
+    {
+        const __m128i is_dead16 = _mm_loadu_si128((const __m128i*)(bullet_is_dead + i_src));
+        const __mmask16 alive_mask = (__mmask16)_mm_movemask_epi8(_mm_cmpeq_epi8(is_dead16, _mm_setzero_si128()));
+        if(alive_mask == 0)
+        {
+            continue;
+        }
+
+        left_pack_f32_avx512(next_game_state->bullet_vel_x + i_dst, prev_game_state->bullet_vel_x + i_src, alive_mask);
+        left_pack_f32_avx512(next_game_state->bullet_vel_y + i_dst, prev_game_state->bullet_vel_y + i_src, alive_mask);
+        left_pack_f32_avx512(next_game_state->bullet_pos_x + i_dst, next_game_state->bullet_pos_x + i_src, alive_mask);
+        left_pack_f32_avx512(next_game_state->bullet_pos_y + i_dst, next_game_state->bullet_pos_y + i_src, alive_mask);
+        left_pack_f32_avx512(next_game_state->bullet_prev_pos_x + i_dst, prev_game_state->bullet_pos_x + i_src, alive_mask);
+        left_pack_f32_avx512(next_game_state->bullet_prev_pos_y + i_dst, prev_game_state->bullet_pos_y + i_src, alive_mask);
+        const __m512 wall_hit_time = _mm512_loadu_ps(prev_game_state->bullet_wall_hit_time + i_src);
+        _mm512_storeu_ps(
+            next_game_state->bullet_wall_hit_time + i_dst,
+            _mm512_sub_ps(_mm512_maskz_compress_ps(alive_mask, wall_hit_time), frame_dt16));
+
+        // Widen the team ids to 32 bits so plain AVX-512F can compress them.
+        const __m512i team_id = _mm512_cvtepu8_epi32(_mm_loadu_si128((const __m128i*)(prev_game_state->bullet_team_id + i_src)));
+        _mm_storeu_si128(
+            (__m128i*)(next_game_state->bullet_team_id + i_dst),
+            _mm512_cvtepi32_epi8(_mm512_maskz_compress_epi32(alive_mask, team_id)));
+
+        i_dst += (u32)_mm_popcnt_u32(alive_mask);
+    }
+
+    return compact_bullet_range(next_game_state, prev_game_state, bullet_is_dead, i_src, num_bullets, i_dst);
+}
+#endif
@@ -0,0 +1,33 @@
+#pragma once
+
+#include "common.h"
+#include "game_state.h"
+
+// Removes the bullets marked in 'bullet_is_dead' at the end of a tick, keeping the order of the survivors.
+//
+// Physics only writes bullet positions to 'next_game_state'. The survivors' positions are packed in place there, their
+// velocity and team are gathered from 'prev_game_state', their position in prev becomes their previous position, and
+// their wall hit time is moved on by a frame.
+// All kernels give identical results. Each returns the number of bullets kept.
+
+u32 compact_bullets_scalar(
+    struct GameState* next_game_state,
+    const struct GameState* prev_game_state,
+    const u8* bullet_is_dead,
+    const u32 num_bullets);
+
+// Left-packs 8 bullets at a time with a permute table indexed by the alive mask.
+u32 compact_bullets_avx2(
+    struct GameState* next_game_state,
+    const struct GameState* prev_game_state,
+    const u8* bullet_is_dead,
+    const u32 num_bullets);
+
+#ifdef __AVX512F__
+// Left-packs 16 bullets at a time with the AVX-512 compress instructions. Only built when the compiler targets AVX-512.
+u32 compact_bullets_avx512(
+    struct GameState* next_game_state,
+    const struct GameState* prev_game_state,
+    const u8* bullet_is_dead,
+    const u32 num_bullets);
+#endif
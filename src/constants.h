@@ -7,3 +7,5 @@
 #define FRAME_DURATION_NS 8333333LL
 
 #define MAX_PLAYERS 256
+
+#define PLAYER_RADIUS 0.5f
@@ -1,5 +1,6 @@
 
 #include "engine.h"
+#include "bullet_compact.h"
 #include "game_input.h"
 #include "math.h"
 #include "constants.h"
@@ -11,52 +12,192 @@
 
 
 
-// NOTE:
-// This will consider overlapping points and line segments as intersecting.
-static inline u8 intersect_line_segments_2d(
-    const v2 a0,
-    const v2 a1,
-    const v2 b0,
-    const v2 b1)
+// Spatial hash of player positions, rebuilt every physics sub-step. Cells are one player diameter wide so touching
+// players are always in the same or neighbouring cells. Players are counting-sorted by hashed cell.
+#define PLAYER_GRID_CELL_SIZE 1.0f
+#define PLAYER_GRID_NUM_CELLS 1024
+_Static_assert((PLAYER_GRID_NUM_CELLS & (PLAYER_GRID_NUM_CELLS - 1)) == 0, "PLAYER_GRID_NUM_CELLS must be a power of 2.");
+_Static_assert(MAX_PLAYERS <= u16_MAX, "Player ids must fit in u16.");
+struct PlayerGrid
 {
-    u8 result = 1;
+    u16 cell_start[PLAYER_GRID_NUM_CELLS + 1];
+    u16 cell_player_id[MAX_PLAYERS];
+};
 
-    {
-        const v2 p0 = a0;
-        const v2 p1 = a1;
-        const v2 q0 = b0;
-        const v2 q1 = b1;
+static inline u32 player_grid_hash(const s32 cell_x, const s32 cell_y)
+{
+    return (((u32)cell_x * 73856093U) ^ ((u32)cell_y * 19349663U)) & (PLAYER_GRID_NUM_CELLS - 1);
+}
 
-        const v2 p01 = sub_v2(p1, p0);
-        const v2 n = make_v2(-p01.y, p01.x);
+static void build_player_grid(
+    struct PlayerGrid* grid,
+    const f32* player_pos_x,
+    const f32* player_pos_y,
+    const u32 num_players)
+{
+    u16 player_cell[MAX_PLAYERS];
+    ZERO_ARRAY(grid->cell_start);
 
-        const f32 d_q0 = dot_v2(sub_v2(q0, p0), n);
-        const f32 d_q1 = dot_v2(sub_v2(q1, p0), n);
+    for(u32 player_id = 0; player_id < num_players; player_id++)
+    {
+        const s32 cell_x = (s32)round_neg_inf(player_pos_x[player_id] * (1.0f / PLAYER_GRID_CELL_SIZE));
+        const s32 cell_y = (s32)round_neg_inf(player_pos_y[player_id] * (1.0f / PLAYER_GRID_CELL_SIZE));
+        const u32 cell = player_grid_hash(cell_x, cell_y);
+        player_cell[player_id] = (u16)cell;
+        grid->cell_start[cell + 1]++;
+    }
 
-        result &= sign_f32(d_q0) ^ sign_f32(d_q1);
-        result |= d_q0 == 0.0f;
+    for(u32 i = 0; i < PLAYER_GRID_NUM_CELLS; i++)
+    {
+        grid->cell_start[i + 1] += grid->cell_start[i];
     }
 
+    u16 cell_end[PLAYER_GRID_NUM_CELLS];
+    COPY(cell_end, grid->cell_start, PLAYER_GRID_NUM_CELLS);
+    for(u32 player_id = 0; player_id < num_players; player_id++)
     {
-        const v2 p0 = b0;
-        const v2 p1 = b1;
-        const v2 q0 = a0;
-        const v2 q1 = a1;
+        grid->cell_player_id[cell_end[player_cell[player_id]]++] = (u16)player_id;
+    }
+}
+
+// Bit array of every player in the 3x3 cells around 'pos', including false positives from hash collisions.
+static void get_player_grid_neighbors(
+    u64 r_neighbors[(MAX_PLAYERS + 63) / 64],
+    const struct PlayerGrid* grid,
+    const v2 pos)
+{
+    memset(r_neighbors, 0, sizeof(u64) * ((MAX_PLAYERS + 63) / 64));
+
+    const s32 cell_x = (s32)round_neg_inf(pos.x * (1.0f / PLAYER_GRID_CELL_SIZE));
+    const s32 cell_y = (s32)round_neg_inf(pos.y * (1.0f / PLAYER_GRID_CELL_SIZE));
+    for(s32 y = cell_y - 1; y <= cell_y + 1; y++)
+    {
+        for(s32 x = cell_x - 1; x <= cell_x + 1; x++)
+        {
+            const u32 cell = player_grid_hash(x, y);
+            for(u32 i = grid->cell_start[cell]; i < grid->cell_start[cell + 1]; i++)
+            {
+                const u32 player_id = grid->cell_player_id[i];
+                r_neighbors[player_id / 64] |= 1ULL << (player_id % 64);
+            }
+        }
+    }
+}
+
+// Uniform grid over the level with every player inserted into each cell its radius-expanded bounds overlap. Used by
+// bullets to find the players near their swept segment. Positions outside the level clamp to the border cells.
+#define PLAYER_BOUNDS_GRID_CELL_SIZE 4.0f
+#define PLAYER_BOUNDS_GRID_MAX_CELLS (64 * 64)
+struct PlayerBoundsGrid
+{
+    s32 cells_x;
+    s32 cells_y;
+    f32 origin_x;
+    f32 origin_y;
 
-        const v2 p01 = sub_v2(p1, p0);
-        const v2 n = make_v2(-p01.y, p01.x);
+    u16 cell_start[PLAYER_BOUNDS_GRID_MAX_CELLS + 1];
+    u16 cell_player_id[MAX_PLAYERS * 4];
+};
 
-        const f32 d_q0 = dot_v2(sub_v2(q0, p0), n);
-        const f32 d_q1 = dot_v2(sub_v2(q1, p0), n);
+static inline s32 player_bounds_grid_cell_x(const struct PlayerBoundsGrid* grid, const f32 x)
+{
+    return clamp_s32((s32)round_neg_inf((x - grid->origin_x) * (1.0f / PLAYER_BOUNDS_GRID_CELL_SIZE)), 0, grid->cells_x - 1);
+}
+
+static inline s32 player_bounds_grid_cell_y(const struct PlayerBoundsGrid* grid, const f32 y)
+{
+    return clamp_s32((s32)round_neg_inf((y - grid->origin_y) * (1.0f / PLAYER_BOUNDS_GRID_CELL_SIZE)), 0, grid->cells_y - 1);
+}
+
+static void build_player_bounds_grid(
+    struct PlayerBoundsGrid* grid,
+    const struct Level* level,
+    const f32* player_pos_x,
+    const f32* player_pos_y,
+    const f32 player_radius,
+    const u32 num_players)
+{
+    ASSERT(player_radius * 2.0f <= PLAYER_BOUNDS_GRID_CELL_SIZE, "Players must overlap at most 2x2 cells.");
+
+    grid->cells_x = (s32)((level->width + (u32)PLAYER_BOUNDS_GRID_CELL_SIZE - 1) / (u32)PLAYER_BOUNDS_GRID_CELL_SIZE);
+    grid->cells_y = (s32)((level->height + (u32)PLAYER_BOUNDS_GRID_CELL_SIZE - 1) / (u32)PLAYER_BOUNDS_GRID_CELL_SIZE);
+    grid->origin_x = -(f32)(level->width / 2);
+    grid->origin_y = -(f32)(level->height / 2);
+    const s32 num_cells = grid->cells_x * grid->cells_y;
+    ASSERT(num_cells <= PLAYER_BOUNDS_GRID_MAX_CELLS, "Level too big for player bounds grid.");
+
+    memset(grid->cell_start, 0, sizeof(grid->cell_start[0]) * (num_cells + 1));
+
+    for(u32 pass = 0; pass < 2; pass++)
+    {
+        for(u32 player_id = 0; player_id < num_players; player_id++)
+        {
+            const s32 x0 = player_bounds_grid_cell_x(grid, player_pos_x[player_id] - player_radius);
+            const s32 x1 = player_bounds_grid_cell_x(grid, player_pos_x[player_id] + player_radius);
+            const s32 y0 = player_bounds_grid_cell_y(grid, player_pos_y[player_id] - player_radius);
+            const s32 y1 = player_bounds_grid_cell_y(grid, player_pos_y[player_id] + player_radius);
+            for(s32 y = y0; y <= y1; y++)
+            {
+                for(s32 x = x0; x <= x1; x++)
+                {
+                    const s32 cell = y * grid->cells_x + x;
+                    if(pass == 0)
+                    {
+                        // Count.
+                        grid->cell_start[cell + 1]++;
+                    }
+                    else
+                    {
+                        // Scatter. cell_start[cell] is used as the write cursor and ends up at the start of the next cell.
+                        grid->cell_player_id[grid->cell_start[cell]++] = (u16)player_id;
+                    }
+                }
+            }
+        }
 
-        result &= sign_f32(d_q0) ^ sign_f32(d_q1);
-        result |= d_q0 == 0.0f;
+        if(pass == 0)
+        {
+            for(s32 i = 0; i < num_cells; i++)
+            {
+                grid->cell_start[i + 1] += grid->cell_start[i];
+            }
+        }
     }
 
-    return result;
+    // Undo the scatter cursors.
+    for(s32 i = num_cells; i > 0; i--)
+    {
+        grid->cell_start[i] = grid->cell_start[i - 1];
+    }
+    grid->cell_start[0] = 0;
 }
 
+// Bit array of every player whose bounds overlap the cells touched by the bounding box of segment a-b.
+static void get_player_bounds_grid_overlaps(
+    u64 r_players[(MAX_PLAYERS + 63) / 64],
+    const struct PlayerBoundsGrid* grid,
+    const v2 a,
+    const v2 b)
+{
+    memset(r_players, 0, sizeof(u64) * ((MAX_PLAYERS + 63) / 64));
 
+    const s32 x0 = player_bounds_grid_cell_x(grid, min_f32(a.x, b.x));
+    const s32 x1 = player_bounds_grid_cell_x(grid, max_f32(a.x, b.x));
+    const s32 y0 = player_bounds_grid_cell_y(grid, min_f32(a.y, b.y));
+    const s32 y1 = player_bounds_grid_cell_y(grid, max_f32(a.y, b.y));
+    for(s32 y = y0; y <= y1; y++)
+    {
+        for(s32 x = x0; x <= x1; x++)
+        {
+            const s32 cell = y * grid->cells_x + x;
+            for(u32 i = grid->cell_start[cell]; i < grid->cell_start[cell + 1]; i++)
+            {
+                const u32 player_id = grid->cell_player_id[i];
+                r_players[player_id / 64] |= 1ULL << (player_id % 64);
+            }
+        }
+    }
+}
 
 static void init_game_state(struct GameState* game_state)
 {
@@ -105,34 +246,501 @@ static void init_game_state(struct GameState* game_state)
     game_state->num_bullets = 0;
 }
 
-static void update_physics(
-    struct GameState* game_state,
+// Integrates bullet positions by one sub-step and marks bullets that have reached a wall by 'sub_step_end_t', the time
+// since the start of the frame at the end of the sub-step, as dead.
+// Writes the stepped positions to bullet_pos, which may alias bullet_src_pos.
+static void integrate_bullets_scalar(
+    f32* bullet_pos_x,
+    f32* bullet_pos_y,
     u8* bullet_is_dead,
-    const struct GameInput* game_input)
+    const f32* bullet_src_pos_x,
+    const f32* bullet_src_pos_y,
+    const f32* bullet_vel_x,
+    const f32* bullet_vel_y,
+    const f32* bullet_wall_hit_time,
+    const u32 num_bullets,
+    const f32 sub_dt,
+    const f32 sub_step_end_t)
 {
-    const u32 num_iterations = 16;
-    const f32 sub_dt = (f32)FRAME_DURATION_NS * (1.0f / 1000000000.0f) * (1.0f / (f32)num_iterations);
-    const f32 max_accel = 4000.0f / (f32)num_iterations;
-    const f32 drag = -250.0f / (f32)num_iterations;
+    // NOTE: Keep the operations in the same order as integrate_bullets_avx2, one rounding per statement, so both
+    //       paths give identical results.
+    for(u32 i = 0; i < num_bullets; i++)
+    {
+        const f32 step_x = bullet_vel_x[i] * sub_dt;
+        const f32 step_y = bullet_vel_y[i] * sub_dt;
+        const f32 pos_x = bullet_src_pos_x[i] + step_x;
+        const f32 pos_y = bullet_src_pos_y[i] + step_y;
+        bullet_pos_x[i] = pos_x;
+        bullet_pos_y[i] = pos_y;
+
+        ASSERT(pos_x >= -1000.0f, "Bullet out of bounds.");
+        ASSERT(pos_x < 1000.0f, "Bullet out of bounds.");
+        ASSERT(pos_y >= -1000.0f, "Bullet out of bounds.");
+        ASSERT(pos_y < 1000.0f, "Bullet out of bounds.");
+
+        bullet_is_dead[i] |= bullet_wall_hit_time[i] <= sub_step_end_t;
+    }
+}
+
+// Same as integrate_bullets_scalar for 8 bullets at a time. num_bullets must be a multiple of 8.
+// Returns the number of bullets processed.
+static u32 integrate_bullets_avx2(
+    f32* bullet_pos_x,
+    f32* bullet_pos_y,
+    u8* bullet_is_dead,
+    const f32* bullet_src_pos_x,
+    const f32* bullet_src_pos_y,
+    const f32* bullet_vel_x,
+    const f32* bullet_vel_y,
+    const f32* bullet_wall_hit_time,
+    const u32 num_bullets,
+    const f32 sub_dt,
+    const f32 sub_step_end_t)
+{
+    ASSERT((num_bullets & 7) == 0, "num_bullets must be a multiple of 8.");
+
+    const __m256 sub_dt8 = _mm256_set1_ps(sub_dt);
+    const __m256 sub_step_end_t8 = _mm256_set1_ps(sub_step_end_t);
+    const __m256 min_bound8 = _mm256_set1_ps(-1000.0f);
+    const __m256 max_bound8 = _mm256_set1_ps(1000.0f);
+
+    for(u32 i = 0; i < num_bullets; i += 8)
+    {
+        const __m256 step_x = _mm256_mul_ps(_mm256_loadu_ps(bullet_vel_x + i), sub_dt8);
+        const __m256 step_y = _mm256_mul_ps(_mm256_loadu_ps(bullet_vel_y + i), sub_dt8);
+        const __m256 pos_x = _mm256_add_ps(_mm256_loadu_ps(bullet_src_pos_x + i), step_x);
+        const __m256 pos_y = _mm256_add_ps(_mm256_loadu_ps(bullet_src_pos_y + i), step_y);
+        _mm256_storeu_ps(bullet_pos_x + i, pos_x);
+        _mm256_storeu_ps(bullet_pos_y + i, pos_y);
+
+        __m256 out_of_bounds = _mm256_cmp_ps(pos_x, min_bound8, _CMP_NGE_UQ);
+        out_of_bounds = _mm256_or_ps(out_of_bounds, _mm256_cmp_ps(pos_x, max_bound8, _CMP_NLT_UQ));
+        out_of_bounds = _mm256_or_ps(out_of_bounds, _mm256_cmp_ps(pos_y, min_bound8, _CMP_NGE_UQ));
+        out_of_bounds = _mm256_or_ps(out_of_bounds, _mm256_cmp_ps(pos_y, max_bound8, _CMP_NLT_UQ));
+        ASSERT(_mm256_movemask_ps(out_of_bounds) == 0, "Bullet out of bounds.");
+
+        const __m256 hit = _mm256_cmp_ps(_mm256_loadu_ps(bullet_wall_hit_time + i), sub_step_end_t8, _CMP_LE_OQ);
+
+        // 8 x 32 bit lane masks -> 8 x u8 0 or 1.
+        const __m256i hit_i = _mm256_castps_si256(hit);
+        __m128i hit_u8 = _mm_packs_epi32(_mm256_castsi256_si128(hit_i), _mm256_extracti128_si256(hit_i, 1));
+        hit_u8 = _mm_packs_epi16(hit_u8, hit_u8);
+        hit_u8 = _mm_and_si128(hit_u8, _mm_set1_epi8(1));
+        u64 is_dead;
+        memcpy(&is_dead, bullet_is_dead + i, sizeof(is_dead));
+        is_dead |= (u64)_mm_cvtsi128_si64(hit_u8);
+        memcpy(bullet_is_dead + i, &is_dead, sizeof(is_dead));
+    }
+
+    return num_bullets;
+}
+
+// Contact passes per physics sub-step. A pass only moves impulses one neighbour along a chain of touching players, but
+// the impulses carried over from the last sub-step already hold a settled crowd apart.
+#define PLAYER_CONTACT_PASSES 1
+// Physics sub-steps per contact of the most crowded player. Each sub-step moves the carried impulses one contact
+// further through a crowd.
+#define PHYSICS_SUB_STEPS_PER_CONTACT 2
+
+// Player pairs in contact during one physics sub-step.
+struct PlayerContacts
+{
+    u32 num_contacts;
+    u16 player_a[MAX_PLAYER_CONTACTS];
+    u16 player_b[MAX_PLAYER_CONTACTS];
+    // Unit normal pointing from b to a.
+    f32 normal_x[MAX_PLAYER_CONTACTS];
+    f32 normal_y[MAX_PLAYER_CONTACTS];
+    // Normal impulse applied so far this sub-step, and by the last pass.
+    f32 impulse[MAX_PLAYER_CONTACTS];
+    f32 delta_impulse[MAX_PLAYER_CONTACTS];
+
+    // Contacts of player p are player_contacts[player_first[p]] to player_contacts[player_first[p + 1] - 1], ascending.
+    u32 player_first[MAX_PLAYERS + 1];
+    u32 player_contacts[MAX_PLAYER_CONTACTS * 2];
+};
+
+// Finds all touching player pairs, sorted by pair, and starts each from the impulse the cache has for it.
+static void find_player_contacts(
+    struct PlayerContacts* contacts,
+    const struct PlayerContactCache* contact_cache,
+    const f32 warm_start_scale,
+    const f32* player_pos_x,
+    const f32* player_pos_y,
+    const u32 num_players,
+    const f32 player_radius,
+    const struct PlayerGrid* player_grid)
+{
+    u32 num_contacts = 0;
+    u32 i_cached = 0;
+    for(u32 a_id = 0; a_id < num_players; a_id++)
+    {
+        const v2 a_pos = make_v2(player_pos_x[a_id], player_pos_y[a_id]);
+
+        // Only pairs with b > a, so each pair is found once and in ascending order.
+        u64 neighbors[(MAX_PLAYERS + 63) / 64];
+        get_player_grid_neighbors(neighbors, player_grid, a_pos);
+        for(u32 i_word = 0; i_word <= a_id / 64; i_word++)
+        {
+            neighbors[i_word] &= i_word < a_id / 64 ? 0 : ~0ULL << (a_id % 64) << 1;
+        }
+
+        for(u32 i_word = 0; i_word < ARRAY_COUNT(neighbors); i_word++)
+        {
+            for(u64 word = neighbors[i_word]; word; word &= word - 1)
+            {
+                const u32 b_id = i_word * 64 + (u32)_tzcnt_u64(word);
+                const v2 b_pos = make_v2(player_pos_x[b_id], player_pos_y[b_id]);
+                const v2 n = sub_v2(a_pos, b_pos);
+                const f32 dist_sq = dot_v2(n, n);
+                // A crowd packed tighter than MAX_PLAYER_CONTACTS allows keeps its lowest pairs and leaves the rest
+                // unsolved rather than overflowing.
+                if(dist_sq >= sq_f32(player_radius * 2.0f) || dist_sq == 0.0f ||
+                    num_contacts == MAX_PLAYER_CONTACTS)
+                {
+                    continue;
+                }
+
+                const u32 pair = (a_id << 16) | b_id;
+                while(i_cached < contact_cache->num_contacts && contact_cache->pair[i_cached] < pair)
+                {
+                    i_cached++;
+                }
+                const u8 is_cached = i_cached < contact_cache->num_contacts && contact_cache->pair[i_cached] == pair;
+
+                const v2 normal = scale_v2(n, 1.0f / sqrt_f32(dist_sq));
+                contacts->player_a[num_contacts] = (u16)a_id;
+                contacts->player_b[num_contacts] = (u16)b_id;
+                contacts->normal_x[num_contacts] = normal.x;
+                contacts->normal_y[num_contacts] = normal.y;
+                contacts->impulse[num_contacts] = is_cached ? contact_cache->impulse[i_cached] * warm_start_scale : 0.0f;
+                num_contacts++;
+            }
+        }
+    }
+    contacts->num_contacts = num_contacts;
+
+    // Counting sort the contacts by player, keeping them ascending within each player.
+    u32* player_first = contacts->player_first;
+    for(u32 player_id = 0; player_id <= num_players; player_id++)
+    {
+        player_first[player_id] = 0;
+    }
+    for(u32 i = 0; i < num_contacts; i++)
+    {
+        player_first[contacts->player_a[i] + 1]++;
+        player_first[contacts->player_b[i] + 1]++;
+    }
+    for(u32 player_id = 0; player_id < num_players; player_id++)
+    {
+        player_first[player_id + 1] += player_first[player_id];
+    }
+    u32 player_next[MAX_PLAYERS];
+    COPY(player_next, player_first, num_players);
+    for(u32 i = 0; i < num_contacts; i++)
+    {
+        contacts->player_contacts[player_next[contacts->player_a[i]]++] = i;
+        contacts->player_contacts[player_next[contacts->player_b[i]]++] = i;
+    }
+}
+
+// Adds the impulse of each contact to both its players, with opposite signs so momentum is conserved exactly. Each
+// player sums its own contacts in ascending order and only writes its own velocity.
+static void apply_player_contact_impulses(
+    f32* player_vel_x,
+    f32* player_vel_y,
+    const struct PlayerContacts* contacts,
+    const f32* impulse,
+    const u32 num_players)
+{
+    for(u32 player_id = 0; player_id < num_players; player_id++)
+    {
+        v2 vel = make_v2(player_vel_x[player_id], player_vel_y[player_id]);
+        for(u32 i = contacts->player_first[player_id]; i < contacts->player_first[player_id + 1]; i++)
+        {
+            const u32 i_contact = contacts->player_contacts[i];
+            const f32 j = contacts->player_a[i_contact] == player_id ? impulse[i_contact] : -impulse[i_contact];
+            vel = add_v2(vel, scale_v2(make_v2(contacts->normal_x[i_contact], contacts->normal_y[i_contact]), j));
+        }
+        player_vel_x[player_id] = vel.x;
+        player_vel_y[player_id] = vel.y;
+    }
+}
+
+// One pass of the contact solve. Each contact finds the impulse that stops its players approaching each other from the
+// velocities at the start of the pass, so the result does not depend on the order contacts are solved in. The total
+// impulse of a contact may only push its players apart, so part of an impulse carried over can be taken back.
+static void solve_player_contact_impulses(
+    struct PlayerContacts* contacts,
+    const f32* player_vel_x,
+    const f32* player_vel_y)
+{
+    for(u32 i = 0; i < contacts->num_contacts; i++)
+    {
+        const u32 a_id = contacts->player_a[i];
+        const u32 b_id = contacts->player_b[i];
+        const v2 rel_vel = make_v2(player_vel_x[a_id] - player_vel_x[b_id], player_vel_y[a_id] - player_vel_y[b_id]);
+        const f32 approach_speed = -dot_v2(rel_vel, make_v2(contacts->normal_x[i], contacts->normal_y[i]));
+
+        // Both players have the same mass, so each takes half.
+        const f32 impulse = max_f32(contacts->impulse[i] + approach_speed * 0.5f, 0.0f);
+        contacts->delta_impulse[i] = impulse - contacts->impulse[i];
+        contacts->impulse[i] = impulse;
+    }
+}
+
+// Removes the velocity of each player towards any wall it touches. Walls are resolved in order.
+static void resolve_player_walls_scalar(
+    f32* player_vel_x,
+    f32* player_vel_y,
+    const f32* player_pos_x,
+    const f32* player_pos_y,
+    const u32 num_players,
+    const f32 player_radius,
+    const struct WallGrid* wall_grid)
+{
+    for(u32 player_id = 0; player_id < num_players; player_id++)
+    {
+        const v2 player_pos = make_v2(player_pos_x[player_id], player_pos_y[player_id]);
+        const f32 player_r = player_radius;
+        v2 player_vel = make_v2(player_vel_x[player_id], player_vel_y[player_id]);
+
+        for(u32 i_wall = 0; i_wall < wall_grid->num_walls; i_wall++)
+        {
+            v2 clamped_pos = player_pos;
+            clamped_pos.x = clamp_f32(player_pos.x, wall_grid->wall_min_x[i_wall], wall_grid->wall_max_x[i_wall]);
+            clamped_pos.y = clamp_f32(player_pos.y, wall_grid->wall_min_y[i_wall], wall_grid->wall_max_y[i_wall]);
+
+            const v2 n = sub_v2(player_pos, clamped_pos);
+            if(dot_v2(n, n) < sq_f32(player_r) &&
+               dot_v2(n, player_vel) < 0.0f)
+            {
+                const f32 j = dot_v2(scale_v2(player_vel, -1.0f), n) / dot_v2(n, n);
+                player_vel = add_v2(player_vel, scale_v2(n, j));
+            }
+        }
+
+        player_vel_x[player_id] = player_vel.x;
+        player_vel_y[player_id] = player_vel.y;
+    }
+}
 
+// Same as resolve_player_walls_scalar for 8 players at a time. num_players must be a multiple of 8.
+// Returns the number of players processed.
+static u32 resolve_player_walls_avx2(
+    f32* player_vel_x,
+    f32* player_vel_y,
+    const f32* player_pos_x,
+    const f32* player_pos_y,
+    const u32 num_players,
+    const f32 player_radius,
+    const struct WallGrid* wall_grid)
+{
+    ASSERT((num_players & 7) == 0, "num_players must be a multiple of 8.");
+
+    const __m256 r_sq8 = _mm256_set1_ps(sq_f32(player_radius));
+    const __m256 zero8 = _mm256_setzero_ps();
+    const __m256 neg_one8 = _mm256_set1_ps(-1.0f);
+
+    for(u32 i = 0; i < num_players; i += 8)
+    {
+        const __m256 pos_x = _mm256_loadu_ps(player_pos_x + i);
+        const __m256 pos_y = _mm256_loadu_ps(player_pos_y + i);
+        __m256 vel_x = _mm256_loadu_ps(player_vel_x + i);
+        __m256 vel_y = _mm256_loadu_ps(player_vel_y + i);
+
+        for(u32 i_wall = 0; i_wall < wall_grid->num_walls; i_wall++)
+        {
+            // Same operand order as clamp_f32 so ties and NaNs resolve the same way.
+            const __m256 clamped_x = _mm256_min_ps(
+                _mm256_max_ps(pos_x, _mm256_broadcast_ss(&wall_grid->wall_min_x[i_wall])),
+                _mm256_broadcast_ss(&wall_grid->wall_max_x[i_wall]));
+            const __m256 clamped_y = _mm256_min_ps(
+                _mm256_max_ps(pos_y, _mm256_broadcast_ss(&wall_grid->wall_min_y[i_wall])),
+                _mm256_broadcast_ss(&wall_grid->wall_max_y[i_wall]));
+
+            const __m256 n_x = _mm256_sub_ps(pos_x, clamped_x);
+            const __m256 n_y = _mm256_sub_ps(pos_y, clamped_y);
+            const __m256 n_sq = _mm256_add_ps(_mm256_mul_ps(n_x, n_x), _mm256_mul_ps(n_y, n_y));
+            const __m256 n_dot_vel = _mm256_add_ps(_mm256_mul_ps(n_x, vel_x), _mm256_mul_ps(n_y, vel_y));
+            const __m256 mask = _mm256_and_ps(
+                _mm256_cmp_ps(n_sq, r_sq8, _CMP_LT_OQ),
+                _mm256_cmp_ps(n_dot_vel, zero8, _CMP_LT_OQ));
+            if(_mm256_movemask_ps(mask) == 0)
+            {
+                continue;
+            }
+
+            const __m256 neg_vel_dot_n = _mm256_add_ps(
+                _mm256_mul_ps(_mm256_mul_ps(vel_x, neg_one8), n_x),
+                _mm256_mul_ps(_mm256_mul_ps(vel_y, neg_one8), n_y));
+            const __m256 j = _mm256_div_ps(neg_vel_dot_n, n_sq);
+            vel_x = _mm256_blendv_ps(vel_x, _mm256_add_ps(vel_x, _mm256_mul_ps(n_x, j)), mask);
+            vel_y = _mm256_blendv_ps(vel_y, _mm256_add_ps(vel_y, _mm256_mul_ps(n_y, j)), mask);
+        }
+
+        _mm256_storeu_ps(player_vel_x + i, vel_x);
+        _mm256_storeu_ps(player_vel_y + i, vel_y);
+    }
+
+    return num_players;
+}
+
+// Bullets are independent of each other, so any split over threads gives the same result.
+#define INTEGRATE_BULLETS_JOB_GRAIN 1024
+struct IntegrateBulletsJob
+{
+    f32* bullet_pos_x;
+    f32* bullet_pos_y;
+    u8* bullet_is_dead;
+    const f32* bullet_src_pos_x;
+    const f32* bullet_src_pos_y;
+    const f32* bullet_vel_x;
+    const f32* bullet_vel_y;
+    const f32* bullet_wall_hit_time;
+    f32 sub_dt;
+    f32 sub_step_end_t;
+    u8 use_avx2;
+};
+
+static void integrate_bullets_job(void* data, const u32 begin, const u32 end, const u32 thread_idx)
+{
+    (void)thread_idx;
+
+    const struct IntegrateBulletsJob* job = data;
+
+    u32 i_bullet = begin;
+    if(job->use_avx2)
+    {
+        i_bullet += integrate_bullets_avx2(
+            job->bullet_pos_x + begin,
+            job->bullet_pos_y + begin,
+            job->bullet_is_dead + begin,
+            job->bullet_src_pos_x + begin,
+            job->bullet_src_pos_y + begin,
+            job->bullet_vel_x + begin,
+            job->bullet_vel_y + begin,
+            job->bullet_wall_hit_time + begin,
+            (end - begin) & ~7U,
+            job->sub_dt,
+            job->sub_step_end_t);
+    }
+    integrate_bullets_scalar(
+        job->bullet_pos_x + i_bullet,
+        job->bullet_pos_y + i_bullet,
+        job->bullet_is_dead + i_bullet,
+        job->bullet_src_pos_x + i_bullet,
+        job->bullet_src_pos_y + i_bullet,
+        job->bullet_vel_x + i_bullet,
+        job->bullet_vel_y + i_bullet,
+        job->bullet_wall_hit_time + i_bullet,
+        end - i_bullet,
+        job->sub_dt,
+        job->sub_step_end_t);
+}
+
+// Smallest number of sub-steps that keeps every player moving less than half a radius per sub-step, so players
+// cannot tunnel into walls or through each other between collision passes. Bullets are swept from their position at
+// the start of the frame to the end of each sub-step and do not need small steps, but a bullet hit can speed a player
+// up mid-frame, so the fastest bullet's impulse is included.
+// Players pressed against each other only pass impulses one neighbour further per contact pass, so a crowd needs
+// several sub-steps to settle. The contacts come from the contact cache, whose impulses carry over between sub-steps
+// and frames, so a settled crowd needs fewer than one solved from scratch.
+static u32 get_num_sub_steps(
+    const struct PlayerContactCache* contact_cache,
+    const struct GameState* game_state,
+    const f32 player_radius,
+    const f32 max_accel,
+    const f32 bullet_impulse_scale)
+{
     const u32 num_players = game_state->num_players;
-    const f32 player_radius = 0.5f;
-    f32* player_vel_x = game_state->player_vel_x;
-    f32* player_vel_y = game_state->player_vel_y;
-    f32* player_pos_x = game_state->player_pos_x;
-    f32* player_pos_y = game_state->player_pos_y;
-    s32* player_health = game_state->player_health;
-    u8* player_team_id = game_state->player_team_id;
-
-    const u32 num_bullets = game_state->num_bullets;
-    f32* bullet_vel_x = game_state->bullet_vel_x;
-    f32* bullet_vel_y = game_state->bullet_vel_y;
-    f32* bullet_pos_x = game_state->bullet_pos_x;
-    f32* bullet_pos_y = game_state->bullet_pos_y;
-    f32* bullet_prev_pos_x = game_state->bullet_prev_pos_x;
-    f32* bullet_prev_pos_y = game_state->bullet_prev_pos_y;
-    u8* bullet_team_id = game_state->bullet_team_id;
+    const f32 frame_dt = (f32)FRAME_DURATION_NS * (1.0f / 1000000000.0f);
+
+    f32 max_player_speed_sq = 0.0f;
+    for(u32 player_id = 0; player_id < num_players; player_id++)
+    {
+        const v2 vel = make_v2(game_state->player_vel_x[player_id], game_state->player_vel_y[player_id]);
+        max_player_speed_sq = max_f32(max_player_speed_sq, length_sq_v2(vel));
+    }
 
+    f32 max_bullet_speed_sq = 0.0f;
+    for(u32 i = 0; i < game_state->num_bullets; i++)
+    {
+        const v2 vel = make_v2(game_state->bullet_vel_x[i], game_state->bullet_vel_y[i]);
+        max_bullet_speed_sq = max_f32(max_bullet_speed_sq, length_sq_v2(vel));
+    }
+
+    const f32 max_speed =
+        sqrt_f32(max_player_speed_sq) +
+        max_accel * frame_dt +
+        sqrt_f32(max_bullet_speed_sq) * bullet_impulse_scale;
+    const f32 max_dist = max_speed * frame_dt;
+
+    // Most players any one player touched on the last sub-step.
+    u8 num_contacts[MAX_PLAYERS] = {};
+    u32 max_contacts = 0;
+    for(u32 i = 0; i < contact_cache->num_contacts; i++)
+    {
+        const u32 a_id = contact_cache->pair[i] >> 16;
+        const u32 b_id = contact_cache->pair[i] & 0xFFFF;
+        num_contacts[a_id] = (u8)min_u32(num_contacts[a_id] + 1U, u8_MAX);
+        num_contacts[b_id] = (u8)min_u32(num_contacts[b_id] + 1U, u8_MAX);
+        max_contacts = max_u32(max_contacts, max_u32(num_contacts[a_id], num_contacts[b_id]));
+    }
+
+    const f32 max_step = player_radius * 0.5f;
+    const f32 num_sub_steps = max_f32(round_pos_inf(max_dist / max_step), (f32)(max_contacts * PHYSICS_SUB_STEPS_PER_CONTACT));
+    return (u32)clamp_f32(num_sub_steps, 1.0f, (f32)PHYSICS_MAX_SUB_STEPS);
+}
+
+// Steps the players and bullets of 'prev_game_state' into 'next_game_state'. The first sub-step reads prev and writes
+// next, later ones update next in place, so nothing is copied up front. Bullet velocities, teams and start positions
+// are never written during the frame and stay in prev; next only gets its bullet positions here.
+// Returns the number of sub-steps used.
+static u32 update_physics(
+    struct JobSystem* job_system,
+    const struct GameState* prev_game_state,
+    struct GameState* next_game_state,
+    u8* bullet_is_dead,
+    struct PlayerContactCache* contact_cache,
+    const struct GameInput* game_input,
+    const struct WallGrid* wall_grid,
+    const u8 use_avx2,
+    const u8 adaptive_sub_steps)
+{
+    const f32 player_radius = PLAYER_RADIUS;
+    const f32 bullet_impulse_scale = 0.1f;
+
+    // Tuned at 16 sub-steps and kept fixed so movement does not depend on the sub-step count.
+    const f32 max_accel = 4000.0f / 16.0f;
+    const f32 drag = -250.0f / 16.0f;
+
+    struct PlayerGrid player_grid;
+    struct PlayerBoundsGrid player_bounds_grid;
+    struct PlayerContacts player_contacts;
+
+    const u32 num_iterations =
+        adaptive_sub_steps
+        ? get_num_sub_steps(contact_cache, prev_game_state, player_radius, max_accel, bullet_impulse_scale)
+        : PHYSICS_MAX_SUB_STEPS;
+    const f32 sub_dt = (f32)FRAME_DURATION_NS * (1.0f / 1000000000.0f) * (1.0f / (f32)num_iterations);
+
+    struct GameState* game_state = next_game_state;
+    const u32 num_players = prev_game_state->num_players;
+    f32* player_vel_x = next_game_state->player_vel_x;
+    f32* player_vel_y = next_game_state->player_vel_y;
+    s32* player_health = next_game_state->player_health;
+    const u8* player_team_id = prev_game_state->player_team_id;
+
+    const u32 num_bullets = prev_game_state->num_bullets;
+    const f32* bullet_vel_x = prev_game_state->bullet_vel_x;
+    const f32* bullet_vel_y = prev_game_state->bullet_vel_y;
+    const f32* bullet_prev_pos_x = prev_game_state->bullet_pos_x;
+    const f32* bullet_prev_pos_y = prev_game_state->bullet_pos_y;
+    const u8* bullet_team_id = prev_game_state->bullet_team_id;
+    const f32* bullet_wall_hit_time = prev_game_state->bullet_wall_hit_time;
+
+    ASSERT(next_game_state->num_players == num_players, "Player count mismatch.");
     ASSERT(game_state->cur_level == 0, "TODO levels");
     const struct Level* level = &LEVEL0;
 
@@ -141,12 +749,22 @@ static void update_physics(
     {
         // Note: The order with which we process kinematics and collisions is important.
 
+        // Positions are read from prev until the first integration below writes them to next.
+        const f32* player_pos_x = iteration == 0 ? prev_game_state->player_pos_x : next_game_state->player_pos_x;
+        const f32* player_pos_y = iteration == 0 ? prev_game_state->player_pos_y : next_game_state->player_pos_y;
+        const f32* bullet_pos_x = iteration == 0 ? prev_game_state->bullet_pos_x : next_game_state->bullet_pos_x;
+        const f32* bullet_pos_y = iteration == 0 ? prev_game_state->bullet_pos_y : next_game_state->bullet_pos_y;
+
         // Integrate forces into player velocity.
+        // This is the first write of each player's next state, so health is carried over here too.
+        const f32* src_player_vel_x = iteration == 0 ? prev_game_state->player_vel_x : player_vel_x;
+        const f32* src_player_vel_y = iteration == 0 ? prev_game_state->player_vel_y : player_vel_y;
+        const s32* src_player_health = iteration == 0 ? prev_game_state->player_health : player_health;
         for(u32 player_id = 0; player_id < num_players; player_id++)
         {
             const struct PlayerInput* player_input = &game_input->player_input[player_id];
             const v2 move_dir = make_v2(player_input->move_x, player_input->move_y);
-            v2 player_vel = make_v2(player_vel_x[player_id], player_vel_y[player_id]);
+            v2 player_vel = make_v2(src_player_vel_x[player_id], src_player_vel_y[player_id]);
 
             v2 accel = zero_v2();
 
@@ -161,61 +779,50 @@ static void update_physics(
 
             player_vel_x[player_id] = player_vel.x;
             player_vel_y[player_id] = player_vel.y;
+            player_health[player_id] = src_player_health[player_id];
         }
         
-        // Resolve bullet-wall collisions.
+        // Resolve bullet-player collisions.
+        // Each bullet is swept from its position at the start of the frame to where it is at the end of this sub-step,
+        // or to the wall it hits if that comes first, so no part of its flight is skipped however few sub-steps there
+        // are. It only tests the players whose bounds share a grid cell with that segment. A bullet hits the lowest id
+        // player it touches, same as testing every player in order.
+        const f32 sub_step_end_t = sub_dt * (f32)(iteration + 1);
+        build_player_bounds_grid(&player_bounds_grid, level, player_pos_x, player_pos_y, player_radius, num_players);
         for(u32 i_bullet = 0; i_bullet < num_bullets; i_bullet++)
         {
-            for(u32 i_wall = 0; i_wall < level->num_walls; i_wall++)
+            if(bullet_is_dead[i_bullet])
             {
-                const v2 bullet_prev_pos = make_v2(bullet_prev_pos_x[i_bullet], bullet_prev_pos_y[i_bullet]);
-                const v2 bullet_pos = make_v2(bullet_pos_x[i_bullet], bullet_pos_y[i_bullet]);
-        
-                const struct LevelWallGeometry* wall = &level->walls[i_wall];
-                const v2 wall_bl = make_v2((f32)wall->x,                  (f32)wall->y);
-                const v2 wall_br = make_v2((f32)(wall->x + (s32)wall->w), (f32)wall->y);
-                const v2 wall_tl = make_v2((f32)wall->x,                  (f32)(wall->y + (s32)wall->h));
-                const v2 wall_tr = make_v2((f32)(wall->x + (s32)wall->w), (f32)(wall->y + (s32)wall->h));
-        
-                u32 hit = 0;
-        
-                // TODO(mfritz):
-                // This is not correct! While playing, an assert fired that bullet went out of bounds.
-                hit |= intersect_line_segments_2d(bullet_prev_pos, bullet_pos, wall_bl, wall_br);
-                hit |= intersect_line_segments_2d(bullet_prev_pos, bullet_pos, wall_br, wall_tr);
-                hit |= intersect_line_segments_2d(bullet_prev_pos, bullet_pos, wall_tr, wall_tl);
-                hit |= intersect_line_segments_2d(bullet_prev_pos, bullet_pos, wall_tl, wall_bl);
-        
-                hit &= !(bullet_is_dead[i_bullet]);
-        
-                if(hit)
-                {
-                    bullet_is_dead[i_bullet] = 1;
-                }
+                continue;
             }
-        }
 
-        // Resolve bullet-player collisions.
-        for(u32 i_bullet = 0; i_bullet < num_bullets; i_bullet++)
-        {
-            for(u32 player_id = 0; player_id < num_players; player_id++)
-            {
-                const v2 bullet_prev_pos = make_v2(bullet_prev_pos_x[i_bullet], bullet_prev_pos_y[i_bullet]);
-                const v2 bullet_pos = make_v2(bullet_pos_x[i_bullet], bullet_pos_y[i_bullet]);
+            const v2 bullet_prev_pos = make_v2(bullet_prev_pos_x[i_bullet], bullet_prev_pos_y[i_bullet]);
+            const v2 bullet_vel = make_v2(bullet_vel_x[i_bullet], bullet_vel_y[i_bullet]);
+            const f32 bullet_t = min_f32(bullet_wall_hit_time[i_bullet], sub_step_end_t);
+            const v2 bullet_pos = add_v2(bullet_prev_pos, scale_v2(bullet_vel, bullet_t));
 
-                const v2 player_pos = make_v2(player_pos_x[player_id], player_pos_y[player_id]);
+            u64 candidates[(MAX_PLAYERS + 63) / 64];
+            get_player_bounds_grid_overlaps(candidates, &player_bounds_grid, bullet_prev_pos, bullet_pos);
 
-                u32 hit = 1;
-                f32 dist = distance_point_line_segment_2d(player_pos, bullet_prev_pos, bullet_pos);
-                hit &= dist < player_radius;
-                hit &= bullet_team_id[i_bullet] != player_team_id[player_id];
-                hit &= !(bullet_is_dead[i_bullet]);
-                if(hit)
+            for(u32 i_word = 0; i_word < ARRAY_COUNT(candidates) && !bullet_is_dead[i_bullet]; i_word++)
+            {
+                for(u64 word = candidates[i_word]; word; word &= word - 1)
                 {
-                    player_vel_x[player_id] += bullet_vel_x[i_bullet] * 0.1f;
-                    player_vel_y[player_id] += bullet_vel_y[i_bullet] * 0.1f;
-                    player_health[player_id] = max_s32(player_health[player_id] - 25, 0);
-                    bullet_is_dead[i_bullet] = 1;
+                    const u32 player_id = i_word * 64 + (u32)_tzcnt_u64(word);
+                    const v2 player_pos = make_v2(player_pos_x[player_id], player_pos_y[player_id]);
+
+                    u32 hit = 1;
+                    f32 dist = distance_point_line_segment_2d(player_pos, bullet_prev_pos, bullet_pos);
+                    hit &= dist < player_radius;
+                    hit &= bullet_team_id[i_bullet] != player_team_id[player_id];
+                    if(hit)
+                    {
+                        player_vel_x[player_id] += bullet_vel.x * bullet_impulse_scale;
+                        player_vel_y[player_id] += bullet_vel.y * bullet_impulse_scale;
+                        player_health[player_id] = max_s32(player_health[player_id] - 25, 0);
+                        bullet_is_dead[i_bullet] = 1;
+                        break;
+                    }
                 }
             }
         }
@@ -267,95 +874,138 @@ static void update_physics(
         }
 
         // Resolve player-player collisions.
-        for(u32 a_id = 0; a_id < num_players; a_id++)
+        // Only players in neighbouring grid cells can touch. Contacts start from the impulse they needed on the last
+        // sub-step, scaled to this sub-step's length, and each pass corrects it.
+        ASSERT(player_radius * 2.0f <= PLAYER_GRID_CELL_SIZE, "Player grid cells are too small.");
+        build_player_grid(&player_grid, player_pos_x, player_pos_y, num_players);
         {
-            const v2 a_pos = make_v2(player_pos_x[a_id], player_pos_y[a_id]);
-            v2 a_vel = make_v2(player_vel_x[a_id], player_vel_y[a_id]);
-            const f32 a_radius = player_radius;
-
-            // Note: This technically makes us dependent on the order of updated players. We could fix this by introducing an intermediate buffer for
-            //       position and velocity.
-            for(u32 b_id = 0; b_id < num_players; b_id++)
+            const f32 warm_start_scale = contact_cache->sub_dt > 0.0f ? sub_dt / contact_cache->sub_dt : 0.0f;
+            find_player_contacts(
+                &player_contacts,
+                contact_cache,
+                warm_start_scale,
+                player_pos_x,
+                player_pos_y,
+                num_players,
+                player_radius,
+                &player_grid);
+            apply_player_contact_impulses(player_vel_x, player_vel_y, &player_contacts, player_contacts.impulse, num_players);
+
+            for(u32 i_pass = 0; i_pass < PLAYER_CONTACT_PASSES; i_pass++)
             {
-                const v2 b_pos = make_v2(player_pos_x[b_id], player_pos_y[b_id]);
-                v2 b_vel = make_v2(player_vel_x[b_id], player_vel_y[b_id]);
-                const f32 b_radius = player_radius;
-
-                const v2 n = sub_v2(a_pos, b_pos);
-                const v2 rel_vel = sub_v2(a_vel, b_vel);
-                if(dot_v2(n, n) < sq_f32(a_radius + b_radius) &&
-                    dot_v2(rel_vel, n) < 0.0f)
-                {
-                    const f32 j = dot_v2(scale_v2(rel_vel, -1.0f), n) / (dot_v2(n, n) * 2.0f);
-
-                    a_vel = add_v2(a_vel, scale_v2(n, j));
-                    b_vel = add_v2(b_vel, scale_v2(n, -j));
-
-                    // Only need to write b_vel out because a_val is cached for this player and will be written at the very end.
-                    player_vel_x[b_id] = b_vel.x;
-                    player_vel_y[b_id] = b_vel.y;
-                }
+                solve_player_contact_impulses(&player_contacts, player_vel_x, player_vel_y);
+                apply_player_contact_impulses(
+                    player_vel_x,
+                    player_vel_y,
+                    &player_contacts,
+                    player_contacts.delta_impulse,
+                    num_players);
             }
 
-            player_vel_x[a_id] = a_vel.x;
-            player_vel_y[a_id] = a_vel.y;
+            contact_cache->num_contacts = player_contacts.num_contacts;
+            for(u32 i = 0; i < player_contacts.num_contacts; i++)
+            {
+                contact_cache->pair[i] = ((u32)player_contacts.player_a[i] << 16) | player_contacts.player_b[i];
+                contact_cache->impulse[i] = player_contacts.impulse[i];
+            }
+            contact_cache->sub_dt = sub_dt;
         }
 
         // Resolve player-wall collisions.
         // Do this after all player-player collisions so it's harder for players to move into walls.
-        for(u32 player_id = 0; player_id < num_players; player_id++)
         {
-            const v2 player_pos = make_v2(player_pos_x[player_id], player_pos_y[player_id]);
-            const f32 player_r = player_radius;
-            v2 player_vel = make_v2(player_vel_x[player_id], player_vel_y[player_id]);
-
-            for(u32 i_wall = 0; i_wall < level->num_walls; i_wall++)
+            u32 player_id = 0;
+            if(use_avx2)
             {
-                const struct LevelWallGeometry* wall = &level->walls[i_wall];
-                const f32 wall_left = (f32)wall->x;
-                const f32 wall_right = (f32)(wall->x + (s32)wall->w);
-                const f32 wall_bottom = (f32)wall->y;
-                const f32 wall_top = (f32)(wall->y + (s32)wall->h);
-
-                v2 clamped_pos = player_pos;
-                clamped_pos.x = clamp_f32(player_pos.x, wall_left, wall_right);
-                clamped_pos.y = clamp_f32(player_pos.y, wall_bottom, wall_top);
-
-                const v2 n = sub_v2(player_pos, clamped_pos);
-                if(dot_v2(n, n) < sq_f32(player_r) &&
-                   dot_v2(n, player_vel) < 0.0f)
-                {
-                    const f32 j = dot_v2(scale_v2(player_vel, -1.0f), n) / dot_v2(n, n);
-                    player_vel = add_v2(player_vel, scale_v2(n, j));
-                }
+                player_id = resolve_player_walls_avx2(
+                    player_vel_x,
+                    player_vel_y,
+                    player_pos_x,
+                    player_pos_y,
+                    num_players & ~7U,
+                    player_radius,
+                    wall_grid);
             }
-
-            player_vel_x[player_id] = player_vel.x;
-            player_vel_y[player_id] = player_vel.y;
+            resolve_player_walls_scalar(
+                player_vel_x + player_id,
+                player_vel_y + player_id,
+                player_pos_x + player_id,
+                player_pos_y + player_id,
+                num_players - player_id,
+                player_radius,
+                wall_grid);
         }
 
         // Integrate velocity into position.
         for(u32 player_id = 0; player_id < num_players; player_id++)
         {
-            player_pos_x[player_id] += player_vel_x[player_id] * sub_dt;
-            player_pos_y[player_id] += player_vel_y[player_id] * sub_dt;
-
-            ASSERT(player_pos_x[player_id] >= -1000.0f, "Bullet out of bounds.");
-            ASSERT(player_pos_x[player_id] < 1000.0f, "Bullet out of bounds.");
-            ASSERT(player_pos_y[player_id] >= -1000.0f, "Bullet out of bounds.");
-            ASSERT(player_pos_y[player_id] < 1000.0f, "Bullet out of bounds.");
+            const f32 pos_x = player_pos_x[player_id] + player_vel_x[player_id] * sub_dt;
+            const f32 pos_y = player_pos_y[player_id] + player_vel_y[player_id] * sub_dt;
+            next_game_state->player_pos_x[player_id] = pos_x;
+            next_game_state->player_pos_y[player_id] = pos_y;
+
+            ASSERT(pos_x >= -1000.0f, "Bullet out of bounds.");
+            ASSERT(pos_x < 1000.0f, "Bullet out of bounds.");
+            ASSERT(pos_y >= -1000.0f, "Bullet out of bounds.");
+            ASSERT(pos_y < 1000.0f, "Bullet out of bounds.");
         }
-        for(u32 i = 0; i < num_bullets; i++)
-        {
-            bullet_pos_x[i] += bullet_vel_x[i] * sub_dt;
-            bullet_pos_y[i] += bullet_vel_y[i] * sub_dt;
 
-            ASSERT(bullet_pos_x[i] >= -1000.0f, "Bullet out of bounds.");
-            ASSERT(bullet_pos_x[i] < 1000.0f, "Bullet out of bounds.");
-            ASSERT(bullet_pos_y[i] >= -1000.0f, "Bullet out of bounds.");
-            ASSERT(bullet_pos_y[i] < 1000.0f, "Bullet out of bounds.");
+        // Integrate bullets and resolve bullet-wall collisions.
+        // Bullets fly straight, so when each one reaches a wall is known from its spawn and this is a compare rather
+        // than a test against every wall. Bullets that hit a wall are marked dead before the next sub-step's
+        // bullet-player pass.
+        {
+#ifdef DEBUG
+            f32 check_pos_x[MAX_BULLETS];
+            f32 check_pos_y[MAX_BULLETS];
+            u8 check_is_dead[MAX_BULLETS];
+            COPY(check_pos_x, bullet_pos_x, num_bullets);
+            COPY(check_pos_y, bullet_pos_y, num_bullets);
+            COPY(check_is_dead, bullet_is_dead, num_bullets);
+#endif
+
+            struct IntegrateBulletsJob job;
+            job.bullet_pos_x = next_game_state->bullet_pos_x;
+            job.bullet_pos_y = next_game_state->bullet_pos_y;
+            job.bullet_is_dead = bullet_is_dead;
+            job.bullet_src_pos_x = bullet_pos_x;
+            job.bullet_src_pos_y = bullet_pos_y;
+            job.bullet_vel_x = bullet_vel_x;
+            job.bullet_vel_y = bullet_vel_y;
+            job.bullet_wall_hit_time = bullet_wall_hit_time;
+            job.sub_dt = sub_dt;
+            job.sub_step_end_t = sub_step_end_t;
+            job.use_avx2 = use_avx2;
+            parallel_for(job_system, num_bullets, INTEGRATE_BULLETS_JOB_GRAIN, integrate_bullets_job, &job);
+
+#ifdef DEBUG
+            // The AVX2 path must match the scalar path bit for bit.
+            if(use_avx2)
+            {
+                integrate_bullets_scalar(
+                    check_pos_x,
+                    check_pos_y,
+                    check_is_dead,
+                    check_pos_x,
+                    check_pos_y,
+                    bullet_vel_x,
+                    bullet_vel_y,
+                    bullet_wall_hit_time,
+                    num_bullets,
+                    sub_dt,
+                    sub_step_end_t);
+                for(u32 i = 0; i < num_bullets; i++)
+                {
+                    ASSERT(f32_bits_as_u32(check_pos_x[i]) == f32_bits_as_u32(job.bullet_pos_x[i]), "AVX2 bullet mismatch %u.", i);
+                    ASSERT(f32_bits_as_u32(check_pos_y[i]) == f32_bits_as_u32(job.bullet_pos_y[i]), "AVX2 bullet mismatch %u.", i);
+                    ASSERT(check_is_dead[i] == bullet_is_dead[i], "AVX2 bullet mismatch %u.", i);
+                }
+            }
+#endif
         }
     }
+
+    return num_iterations;
 }
 
 static void assign_bullet(
@@ -367,6 +1017,7 @@ static void assign_bullet(
     const f32 pos_y,
     const f32 prev_pos_x,
     const f32 prev_pos_y,
+    const f32 wall_hit_time,
     const u8 team_id)
 {
     game_state->bullet_vel_x[idx] = vel_x;
@@ -375,11 +1026,14 @@ static void assign_bullet(
     game_state->bullet_pos_y[idx] = pos_y;
     game_state->bullet_prev_pos_x[idx] = prev_pos_x;
     game_state->bullet_prev_pos_y[idx] = prev_pos_y;
+    game_state->bullet_wall_hit_time[idx] = wall_hit_time;
     game_state->bullet_team_id[idx] = team_id;
 }
 
+// Bullets fly straight until they hit something, so the wall they will hit is found here once.
 static void add_bullet(
     struct GameState* game_state,
+    const struct WallGrid* wall_grid,
     const f32 vel_x,
     const f32 vel_y,
     const f32 pos_x,
@@ -399,16 +1053,31 @@ static void add_bullet(
         pos_y,
         prev_pos_x,
         prev_pos_y,
+        get_wall_box_time_of_impact(wall_grid, pos_x, pos_y, vel_x, vel_y),
         team_id
     );
     game_state->num_bullets = num + 1;
 }
 
+void add_engine_bullet(
+    struct Engine* engine,
+    const f32 vel_x,
+    const f32 vel_y,
+    const f32 pos_x,
+    const f32 pos_y,
+    const u8 team_id)
+{
+    struct GameState* game_state = &engine->game_states[(engine->cur_game_state_idx + 1) & 1];
+    add_bullet(game_state, &engine->wall_grid, vel_x, vel_y, pos_x, pos_y, pos_x, pos_y, team_id);
+}
+
 
 
-void init_engine(struct Engine* engine)
+void init_engine(struct Engine* engine, struct JobSystem* job_system)
 {
     engine->frame_num = 0;
+    engine->job_system = job_system;
+    ZERO_ARRAY(engine->phase_ns);
 
     for(u64 i = 0; i < ARRAY_COUNT(engine->game_states); i++)
     {
@@ -416,11 +1085,39 @@ void init_engine(struct Engine* engine)
     }
     engine->cur_game_state_idx = 0;
 
-    init_path_find(&engine->path_find, &LEVEL0);
+    init_path_find(&engine->path_find);
+    engine->path_find_mode = PATH_FIND_MODE_JPS;
+    init_npc_path_scheduler(&engine->npc_path_scheduler);
+    init_wall_grid(&engine->wall_grid, &LEVEL0);
+    init_path_find_clusters(&engine->path_find_clusters, &engine->path_find, &engine->wall_grid, &LEVEL0);
+    for(u64 i = 0; i < MAX_FLOW_FIELDS; i++)
+    {
+        engine->flow_field_last_used_frame[i] = -1;
+        engine->flow_field_is_stale[i] = 0;
+        engine->flow_field_is_ready[i] = 0;
+    }
+    engine->flow_field_building = NO_FLOW_FIELD;
+    init_path_find(&engine->flow_field_path_find);
+
+    engine->player_contact_cache.num_contacts = 0;
+    engine->player_contact_cache.sub_dt = 0.0f;
+
+    engine->cpu_has_avx2 = platform_cpu_has_avx2();
+
+    engine->physics_adaptive_sub_steps = 1;
+    engine->physics_num_sub_steps = 0;
 
     {
         const struct GameState* game_state = &engine->game_states[engine->cur_game_state_idx];
 
+        for(u64 i = 0; i < MAX_PLAYERS; i++)
+        {
+            engine->npcs[i].path_len = 0;
+            engine->npcs[i].path_cursor = 0;
+            engine->npcs[i].path_requested = 0;
+            engine->npcs[i].path_queued = 0;
+        }
+
         engine->num_npcs = 32;
         for(u64 i = 0; i < 32; i++)
         {
@@ -439,6 +1136,196 @@ void init_engine(struct Engine* engine)
     }
 }
 
+// Groups the npcs by goal cell and points each at a flow field for its goal, marking a field to build for goals with
+// enough npcs. Goals are visited in npc order so slot choice does not depend on threads.
+static void update_npc_flow_fields(struct Engine* engine, const u32 num_players)
+{
+    const s64 frame_num = engine->frame_num;
+
+    u32 num_goals = 0;
+    u16 goal_idxs[MAX_PLAYERS];
+    u32 goal_num_npcs[MAX_PLAYERS];
+    u8 goal_flow_field[MAX_PLAYERS];
+    u32 npc_goal[MAX_PLAYERS];
+    for(u32 i = 1; i < num_players; i++)
+    {
+        const struct Npc* npc = &engine->npcs[i];
+        u16 goal_idx;
+        if(!get_path_find_end_cell(
+            &goal_idx,
+            &engine->wall_grid,
+            &LEVEL0,
+            (s32)round_neg_inf(npc->target_pos_x),
+            (s32)round_neg_inf(npc->target_pos_y)))
+        {
+            npc_goal[i] = u32_MAX;
+            continue;
+        }
+
+        u32 goal = 0;
+        while(goal < num_goals && goal_idxs[goal] != goal_idx)
+        {
+            goal++;
+        }
+        if(goal == num_goals)
+        {
+            goal_idxs[num_goals] = goal_idx;
+            goal_num_npcs[num_goals] = 0;
+            num_goals++;
+        }
+        goal_num_npcs[goal]++;
+        npc_goal[i] = goal;
+    }
+
+    for(u32 goal = 0; goal < num_goals; goal++)
+    {
+        // Reuse a field built on an earlier tick, even if this goal no longer has many npcs.
+        u32 slot = 0;
+        while(slot < MAX_FLOW_FIELDS &&
+              (engine->flow_field_last_used_frame[slot] < 0 || engine->flow_fields[slot].goal_idx != goal_idxs[goal]))
+        {
+            slot++;
+        }
+
+        if(slot == MAX_FLOW_FIELDS && goal_num_npcs[goal] >= FLOW_FIELD_MIN_NPCS)
+        {
+            // Evict the least recently used field not already taken this tick.
+            u32 lru_slot = MAX_FLOW_FIELDS;
+            for(u32 i = 0; i < MAX_FLOW_FIELDS; i++)
+            {
+                if(engine->flow_field_last_used_frame[i] < frame_num &&
+                   (lru_slot == MAX_FLOW_FIELDS ||
+                    engine->flow_field_last_used_frame[i] < engine->flow_field_last_used_frame[lru_slot]))
+                {
+                    lru_slot = i;
+                }
+            }
+
+            if(lru_slot < MAX_FLOW_FIELDS)
+            {
+                slot = lru_slot;
+                engine->flow_fields[slot].goal_idx = goal_idxs[goal];
+                engine->flow_field_is_stale[slot] = 1;
+                engine->flow_field_is_ready[slot] = 0;
+                if(engine->flow_field_building == slot)
+                {
+                    engine->flow_field_building = NO_FLOW_FIELD;
+                }
+            }
+        }
+
+        if(slot < MAX_FLOW_FIELDS)
+        {
+            engine->flow_field_last_used_frame[slot] = frame_num;
+            goal_flow_field[goal] = (u8)slot;
+        }
+        else
+        {
+            goal_flow_field[goal] = NO_FLOW_FIELD;
+        }
+    }
+
+    for(u32 i = 1; i < num_players; i++)
+    {
+        engine->npc_flow_field[i] = npc_goal[i] == u32_MAX ? NO_FLOW_FIELD : goal_flow_field[npc_goal[i]];
+    }
+}
+
+// Builds the stale fields used this tick, in slot order, until FLOW_FIELD_BUILD_BUDGET is spent. A build that runs out
+// of budget carries on from where it stopped on the next tick.
+static void build_flow_fields(struct Engine* engine)
+{
+    u32 budget = FLOW_FIELD_BUILD_BUDGET;
+    while(budget)
+    {
+        if(engine->flow_field_building == NO_FLOW_FIELD)
+        {
+            u32 slot = 0;
+            while(slot < MAX_FLOW_FIELDS &&
+                  (!engine->flow_field_is_stale[slot] || engine->flow_field_last_used_frame[slot] != engine->frame_num))
+            {
+                slot++;
+            }
+            if(slot == MAX_FLOW_FIELDS)
+            {
+                break;
+            }
+            engine->flow_field_is_stale[slot] = 0;
+            engine->flow_field_building = (u8)slot;
+            start_flow_field_build(&engine->flow_field_path_find, &LEVEL0, engine->flow_fields[slot].goal_idx);
+        }
+
+        const u8 slot = engine->flow_field_building;
+        const enum PathFindStatus status = resume_flow_field_build(
+            &engine->flow_fields[slot],
+            &engine->flow_field_path_find,
+            &engine->wall_grid,
+            &LEVEL0,
+            &budget);
+        if(status == PATH_FIND_STATUS_DONE)
+        {
+            engine->flow_field_is_ready[slot] = 1;
+            engine->flow_field_building = NO_FLOW_FIELD;
+        }
+    }
+}
+
+// Jobs below NPC_PATH_NUM_LANES run a lane each, the last one builds flow fields.
+static void run_npc_path_lanes_job(void* data, const u32 begin, const u32 end, const u32 thread_idx)
+{
+    (void)thread_idx;
+    struct Engine* engine = data;
+    for(u32 i = begin; i < end; i++)
+    {
+        if(i == NPC_PATH_NUM_LANES)
+        {
+            build_flow_fields(engine);
+            continue;
+        }
+        run_npc_path_lane(
+            &engine->npc_path_scheduler.lanes[i],
+            engine->npcs,
+            NPC_PATH_BUDGET / NPC_PATH_NUM_LANES,
+            engine->path_find_mode,
+            &engine->path_find_clusters,
+            &engine->wall_grid,
+            &LEVEL0);
+    }
+}
+
+// Each npc only writes its own input and Npc, so npcs can run on any thread in any order.
+struct UpdateNpcsJob
+{
+    struct Engine* engine;
+    struct GameInput* game_input;
+    const struct GameState* game_state;
+    s64 frame_num;
+};
+
+static void update_npcs_job(void* data, const u32 begin, const u32 end, const u32 thread_idx)
+{
+    (void)thread_idx;
+    const struct UpdateNpcsJob* job = data;
+    struct Engine* engine = job->engine;
+
+    // Player 0 is the human.
+    for(u32 i = begin + 1; i < end + 1; i++)
+    {
+        const u8 flow_field_idx = engine->npc_flow_field[i];
+        const u8 has_flow_field = flow_field_idx != NO_FLOW_FIELD;
+        const u8 is_flow_field_ready = has_flow_field && engine->flow_field_is_ready[flow_field_idx];
+        update_npc(&job->game_input->player_input[i],
+                &engine->npcs[i],
+                is_flow_field_ready ? &engine->flow_fields[flow_field_idx] : NULL,
+                has_flow_field && !is_flow_field_ready,
+                &engine->wall_grid,
+                &LEVEL0,
+                job->game_state,
+                i,
+                job->frame_num);
+    }
+}
+
 void tick_engine(struct Engine* engine)
 {
     struct GameState* prev_game_state = &engine->game_states[(engine->cur_game_state_idx + 1) & 1];
@@ -446,9 +1333,8 @@ void tick_engine(struct Engine* engine)
     const s64 frame_num = engine->frame_num;
     
     struct GameInput game_input = {};
-    ASSERT(prev_game_state->num_players == 32, "TODO: variable players");
-    game_input.num_players = 32;
-    ASSERT(game_input.num_players == 32, "TODO: variable players");
+    ASSERT(prev_game_state->num_players <= MAX_PLAYERS, "Player overflow.");
+    game_input.num_players = prev_game_state->num_players;
     platform_read_player_input(
         &game_input.player_input[0],
         prev_game_state->cam_pos_x,
@@ -458,31 +1344,31 @@ void tick_engine(struct Engine* engine)
         prev_game_state->player_pos_x[0],
         prev_game_state->player_pos_y[0]);
 
+    s64 phase_start_ns = platform_get_time_ns();
+    if(game_input.num_players > 1)
     {
-        const u32 num_players = prev_game_state->num_players;
-        COPY(next_game_state->player_vel_x, prev_game_state->player_vel_x, num_players);
-        COPY(next_game_state->player_vel_y, prev_game_state->player_vel_y, num_players);
-        COPY(next_game_state->player_pos_x, prev_game_state->player_pos_x, num_players);
-        COPY(next_game_state->player_pos_y, prev_game_state->player_pos_y, num_players);
-
-        COPY(next_game_state->player_health, prev_game_state->player_health, num_players);
-    }
-
-    for(u64 i = 1; i < game_input.num_players; i++)
-    {
-        struct Npc* npc = &engine->npcs[i];
-        update_npc(&game_input.player_input[i],
-                npc,
-                &engine->path_find,
-                &LEVEL0,
-                prev_game_state,
-                (u32)i,
-                frame_num);
+        for(u32 i = 1; i < game_input.num_players; i++)
+        {
+            update_npc_target(&engine->npcs[i], prev_game_state, i, frame_num);
+        }
+        update_npc_flow_fields(engine, game_input.num_players);
+
+        // Searches for the paths requested on earlier ticks and builds flow fields. Npcs pick up the finished ones
+        // below.
+        schedule_npc_paths(&engine->npc_path_scheduler, engine->npcs, game_input.num_players);
+        parallel_for(engine->job_system, NPC_PATH_NUM_LANES + 1, 1, run_npc_path_lanes_job, engine);
+
+        struct UpdateNpcsJob job;
+        job.engine = engine;
+        job.game_input = &game_input;
+        job.game_state = prev_game_state;
+        job.frame_num = frame_num;
+        parallel_for(engine->job_system, game_input.num_players - 1, 1, update_npcs_job, &job);
     }
+    engine->phase_ns[ENGINE_PHASE_NPC] = platform_get_time_ns() - phase_start_ns;
 
     // Player select NPCs.
     {
-        ASSERT(game_input.num_players == 32, "TODO: variable players");
         const struct PlayerInput* player_input = &game_input.player_input[0];
         const v2 cursor_pos = make_v2(player_input->cursor_pos_x, player_input->cursor_pos_y);
     
@@ -493,7 +1379,7 @@ void tick_engine(struct Engine* engine)
         for(u64 i = 0; i < prev_game_state->num_players; i++)
         {
             const v2 player_pos = make_v2(prev_game_state->player_pos_x[i], prev_game_state->player_pos_y[i]);
-            const f32 player_radius = 0.5f;
+            const f32 player_radius = PLAYER_RADIUS;
             if(length_sq_v2(sub_v2(cursor_pos, player_pos)) <= sq_f32(player_radius))
             {
                 engine->last_selected_player_id =
@@ -523,6 +1409,7 @@ void tick_engine(struct Engine* engine)
             path_find,
             path_x,
             path_y,
+            &engine->wall_grid,
             &LEVEL0,
             start_x,
             start_y,
@@ -549,18 +1436,7 @@ void tick_engine(struct Engine* engine)
 
     u8 bullet_is_dead[MAX_BULLETS] = {};
     {
-        const u32 num_bullets = prev_game_state->num_bullets;
-        COPY(next_game_state->bullet_vel_x, prev_game_state->bullet_vel_x, num_bullets);
-        COPY(next_game_state->bullet_vel_y, prev_game_state->bullet_vel_y, num_bullets);
-        COPY(next_game_state->bullet_pos_x, prev_game_state->bullet_pos_x, num_bullets);
-        COPY(next_game_state->bullet_pos_y, prev_game_state->bullet_pos_y, num_bullets);
-        COPY(next_game_state->bullet_team_id, prev_game_state->bullet_team_id, num_bullets);
-
-        COPY(next_game_state->bullet_prev_pos_x, prev_game_state->bullet_pos_x, num_bullets);
-        COPY(next_game_state->bullet_prev_pos_y, prev_game_state->bullet_pos_y, num_bullets);
-
-        next_game_state->num_bullets = num_bullets;
-        
+        // New bullets are added to prev, the state this tick starts from, so physics steps them like any other.
         const struct PlayerInput* player_input = &game_input.player_input[0];
         if(player_input_get_bool(player_input, PLAYER_INPUT_SHOOT))
         {
@@ -571,7 +1447,8 @@ void tick_engine(struct Engine* engine)
             vel = scale_v2(vel, 400.0f);
 
             add_bullet(
-                next_game_state,
+                prev_game_state,
+                &engine->wall_grid,
                 vel.x,
                 vel.y,
                 player_pos.x,
@@ -582,37 +1459,99 @@ void tick_engine(struct Engine* engine)
         }
     }
 
-    update_physics(next_game_state, bullet_is_dead, &game_input);
+    phase_start_ns = platform_get_time_ns();
+    engine->physics_num_sub_steps = update_physics(
+        engine->job_system,
+        prev_game_state,
+        next_game_state,
+        bullet_is_dead,
+        &engine->player_contact_cache,
+        &game_input,
+        &engine->wall_grid,
+        engine->cpu_has_avx2,
+        engine->physics_adaptive_sub_steps);
+    engine->phase_ns[ENGINE_PHASE_PHYSICS] = platform_get_time_ns() - phase_start_ns;
+
+    phase_start_ns = platform_get_time_ns();
+    // Remove dead bullets.
+#ifdef __AVX512F__
+    next_game_state->num_bullets =
+        compact_bullets_avx512(next_game_state, prev_game_state, bullet_is_dead, prev_game_state->num_bullets);
+#else
+    next_game_state->num_bullets =
+        engine->cpu_has_avx2
+        ? compact_bullets_avx2(next_game_state, prev_game_state, bullet_is_dead, prev_game_state->num_bullets)
+        : compact_bullets_scalar(next_game_state, prev_game_state, bullet_is_dead, prev_game_state->num_bullets);
+#endif
+    engine->phase_ns[ENGINE_PHASE_BULLET_COMPACT] = platform_get_time_ns() - phase_start_ns;
 
+    ASSERT(next_game_state->num_players > 0, "Must have at least 1 player");
+    next_game_state->cam_pos_x = next_game_state->player_pos_x[0];
+    next_game_state->cam_pos_y = next_game_state->player_pos_y[0];
+
+    engine->cur_game_state_idx = (engine->cur_game_state_idx + 1) & 1;
+    engine->frame_num++;
+}
+
+// Returns 1 if a path of the field may lead through or next to the grid cells [x0, x1) x [y0, y1).
+static u8 flow_field_reaches_box(const struct FlowField* flow_field, const s32 x0, const s32 y0, const s32 x1, const s32 y1)
+{
+    for(s32 y = max_s32(y0 - 1, 0); y < min_s32(y1 + 1, 256); y++)
     {
-        // Remove dead bullets.
-        const u64 num_bullets = next_game_state->num_bullets;
-        u64 i_dst = 0;
-        for(u64 i_src = 0; i_src < num_bullets; i_src++)
+        for(s32 x = max_s32(x0 - 1, 0); x < min_s32(x1 + 1, 256); x++)
         {
-            if(!bullet_is_dead[i_src])
+            const u16 cell_idx = (u16)(y * 256 + x);
+            if(cell_idx == flow_field->goal_idx || flow_field->grid_next[cell_idx] != cell_idx)
             {
-                assign_bullet(
-                    next_game_state,
-                    i_dst,
-                    next_game_state->bullet_vel_x[i_src],
-                    next_game_state->bullet_vel_y[i_src],
-                    next_game_state->bullet_pos_x[i_src],
-                    next_game_state->bullet_pos_y[i_src],
-                    next_game_state->bullet_prev_pos_x[i_src],
-                    next_game_state->bullet_prev_pos_y[i_src],
-                    next_game_state->bullet_team_id[i_src]
-                );
-                i_dst++;
+                return 1;
             }
         }
-        next_game_state->num_bullets = (u32)i_dst;
     }
+    return 0;
+}
 
-    ASSERT(next_game_state->num_players > 0, "Must have at least 1 player");
-    next_game_state->cam_pos_x = next_game_state->player_pos_x[0];
-    next_game_state->cam_pos_y = next_game_state->player_pos_y[0];
+void set_engine_path_blocker(
+    struct Engine* engine,
+    const s32 x,
+    const s32 y,
+    const u32 w,
+    const u32 h,
+    const u8 is_blocked)
+{
+    set_wall_grid_cells(&engine->wall_grid, x, y, w, h, is_blocked);
+    update_path_find_clusters(
+        &engine->path_find_clusters,
+        &engine->path_find_clusters_scratch,
+        &engine->path_find,
+        x,
+        y,
+        w,
+        h,
+        &engine->wall_grid,
+        &LEVEL0);
+
+    const s32 grid_x = x - engine->wall_grid.origin_x;
+    const s32 grid_y = y - engine->wall_grid.origin_y;
+
+    // The build in progress only starts over if its search already got to the box. Otherwise it sees the new walls
+    // when it gets there, so toggling a door far from it does not keep restarting it.
+    if(engine->flow_field_building != NO_FLOW_FIELD &&
+       path_find_reached_box(&engine->flow_field_path_find, grid_x, grid_y, grid_x + (s32)w, grid_y + (s32)h))
+    {
+        engine->flow_field_is_stale[engine->flow_field_building] = 1;
+        engine->flow_field_building = NO_FLOW_FIELD;
+    }
 
-    engine->cur_game_state_idx = (engine->cur_game_state_idx + 1) & 1;
-    engine->frame_num++;
+    for(u32 i = 0; i < MAX_FLOW_FIELDS; i++)
+    {
+        if(i != engine->flow_field_building &&
+           engine->flow_field_last_used_frame[i] >= 0 &&
+           flow_field_reaches_box(&engine->flow_fields[i], grid_x, grid_y, grid_x + (s32)w, grid_y + (s32)h))
+        {
+            // Npcs keep following the old field until the rebuild is done, except where it now leads into a wall.
+            engine->flow_field_is_stale[i] = 1;
+        }
+    }
+
+    invalidate_npc_paths(&engine->npc_path_scheduler, engine->npcs, MAX_PLAYERS, x, y, w, h, is_blocked);
 }
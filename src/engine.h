@@ -4,23 +4,116 @@
 #include "common.h"
 #include "game_state.h"
 #include "path_find.h"
+#include "wall_grid.h"
+#include "job_system.h"
 #include "npc.h"
 
+#define PHYSICS_MAX_SUB_STEPS 16
+
+// Npcs heading for the same goal cell share a flow field once there are this many of them. Fields are kept until
+// their slot is needed for another goal.
+#define MAX_FLOW_FIELDS 8
+#define FLOW_FIELD_MIN_NPCS 4
+#define NO_FLOW_FIELD u8_MAX
+// Cells the flow field builds may expand per tick, on top of the npc searches' NPC_PATH_BUDGET. A field over the
+// whole level takes a few ticks.
+#define FLOW_FIELD_BUILD_BUDGET 2048
+
+// Most player pairs solved at once. Players of equal size that do not overlap touch at most six others, so this only
+// runs out for a crowd squeezed far into itself, which then leaves its extra contacts unsolved.
+#define MAX_PLAYER_CONTACTS (MAX_PLAYERS * 8)
+
+// Player pairs touching at the end of the last physics sub-step, sorted by a << 16 | b with a < b, and the normal impulse
+// that kept each pair apart. The next sub-step, on this frame or the next, starts the pairs still touching from it.
+struct PlayerContactCache
+{
+    u32 num_contacts;
+    u32 pair[MAX_PLAYER_CONTACTS];
+    f32 impulse[MAX_PLAYER_CONTACTS];
+    // Sub-step length the impulses were found for, 0 if there are none yet.
+    f32 sub_dt;
+};
+
+enum EnginePhase
+{
+    ENGINE_PHASE_NPC,
+    ENGINE_PHASE_PHYSICS,
+    ENGINE_PHASE_BULLET_COMPACT,
+
+    NUM_ENGINE_PHASES
+};
+
 struct Engine
 {
     s64 frame_num;
 
+    // Owned by the platform layer, which outlives the engine.
+    struct JobSystem* job_system;
+
     u32 cur_game_state_idx;
     struct GameState game_states[2];
 
+    // Path find scratch for the cluster builds and blocker updates. Npc searches run on the npc_path_scheduler lanes,
+    // flow fields on flow_field_path_find.
     struct PathFind path_find;
+    enum PathFindMode path_find_mode;
+    struct PathFindClusters path_find_clusters;
+    struct PathFindClusters path_find_clusters_scratch;
+    struct NpcPathScheduler npc_path_scheduler;
+
+    // Frame each flow field was last used on, -1 if the slot is empty. Stale fields are rebuilt when next used, one
+    // at a time in flow_field_path_find, over as many ticks as FLOW_FIELD_BUILD_BUDGET takes, and npcs follow the
+    // old field until the new one is written, except where it leads into new walls. A field is ready once it has been built for its goal at least once;
+    // until then the npcs heading there wait for it.
+    struct FlowField flow_fields[MAX_FLOW_FIELDS];
+    s64 flow_field_last_used_frame[MAX_FLOW_FIELDS];
+    u8 flow_field_is_stale[MAX_FLOW_FIELDS];
+    u8 flow_field_is_ready[MAX_FLOW_FIELDS];
+    // Slot being built, or NO_FLOW_FIELD.
+    u8 flow_field_building;
+    struct PathFind flow_field_path_find;
+    // Flow field each npc follows this tick, or NO_FLOW_FIELD.
+    u8 npc_flow_field[MAX_PLAYERS];
+    struct WallGrid wall_grid;
+
+    // Selected once in init_engine. Picks the AVX2 or scalar bullet kernels.
+    u8 cpu_has_avx2;
+
+    // When set, each tick picks the fewest physics sub-steps that keep the fastest player from tunneling and give the
+    // most crowded player, counted from player_contact_cache, time to settle. Otherwise every tick uses
+    // PHYSICS_MAX_SUB_STEPS. physics_num_sub_steps is the count the last tick used.
+    u8 physics_adaptive_sub_steps;
+    u32 physics_num_sub_steps;
+    struct PlayerContactCache player_contact_cache;
 
     u32 num_npcs;
     struct Npc npcs[MAX_PLAYERS];
     u32 last_selected_player_id;
 
+    // Time spent in each phase during the last tick_engine.
+    s64 phase_ns[NUM_ENGINE_PHASES];
 };
 
-void init_engine(struct Engine* engine);
+void init_engine(struct Engine* engine, struct JobSystem* job_system);
 
 void tick_engine(struct Engine* engine);
+
+// Blocks the level space box [x, x + w) x [y, y + h) for path finding, or unblocks it, between ticks. Only what the
+// box can affect is redone: the clearance near it, the clusters next to it, flow fields that reach it, and npc paths
+// through it. Npcs avoid blocked cells but the physics does not collide with them.
+void set_engine_path_blocker(
+    struct Engine* engine,
+    const s32 x,
+    const s32 y,
+    const u32 w,
+    const u32 h,
+    const u8 is_blocked);
+
+// Adds a bullet to the latest game state between ticks. It starts moving on the next tick.
+void add_engine_bullet(
+    struct Engine* engine,
+    const f32 vel_x,
+    const f32 vel_y,
+    const f32 pos_x,
+    const f32 pos_y,
+    const u8 team_id);
@@ -33,5 +33,7 @@ struct GameState
     f32 bullet_pos_y[MAX_BULLETS];
     f32 bullet_prev_pos_x[MAX_BULLETS];
     f32 bullet_prev_pos_y[MAX_BULLETS];
+    // Time from the start of the frame until the bullet reaches a wall. Found once at spawn, as bullets fly straight.
+    f32 bullet_wall_hit_time[MAX_BULLETS];
     u8 bullet_team_id[MAX_BULLETS];
 };
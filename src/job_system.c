@@ -0,0 +1,173 @@
+#include "job_system.h"
+#include "atomic.h"
+
+#define JOB_RANGE_EMPTY u64_MAX
+
+static inline u64 pack_job_range(const u32 begin, const u32 end)
+{
+    return ((u64)begin << 32) | end;
+}
+
+// Owner only.
+static void job_deque_push(struct JobDeque* deque, const u64 range)
+{
+    const s64 b = deque->bottom;
+    const s64 t = atomic_load_s64(&deque->top);
+    ASSERT(b - t < JOB_DEQUE_SIZE, "Job deque overflow.");
+    atomic_store_u64(&deque->ranges[b & (JOB_DEQUE_SIZE - 1)], range);
+    atomic_store_s64(&deque->bottom, b + 1);
+}
+
+// Owner only. Takes the newest range.
+static u64 job_deque_pop(struct JobDeque* deque)
+{
+    const s64 b = deque->bottom - 1;
+    atomic_store_s64(&deque->bottom, b);
+    atomic_fence();
+    const s64 t = atomic_load_s64(&deque->top);
+
+    if(t > b)
+    {
+        atomic_store_s64(&deque->bottom, b + 1);
+        return JOB_RANGE_EMPTY;
+    }
+
+    u64 range = atomic_load_u64(&deque->ranges[b & (JOB_DEQUE_SIZE - 1)]);
+    if(t == b)
+    {
+        // Last range, race the thieves for it.
+        if(!atomic_cas_s64(&deque->top, t, t + 1))
+        {
+            range = JOB_RANGE_EMPTY;
+        }
+        atomic_store_s64(&deque->bottom, b + 1);
+    }
+    return range;
+}
+
+// Any thread. Takes the oldest range.
+static u64 job_deque_steal(struct JobDeque* deque)
+{
+    const s64 t = atomic_load_s64(&deque->top);
+    atomic_fence();
+    const s64 b = atomic_load_s64(&deque->bottom);
+    if(t >= b)
+    {
+        return JOB_RANGE_EMPTY;
+    }
+
+    const u64 range = atomic_load_u64(&deque->ranges[t & (JOB_DEQUE_SIZE - 1)]);
+    if(!atomic_cas_s64(&deque->top, t, t + 1))
+    {
+        return JOB_RANGE_EMPTY;
+    }
+    return range;
+}
+
+static void run_job_range(struct JobSystem* job_system, const u32 thread_idx, const u64 range)
+{
+    struct JobDeque* deque = &job_system->deques[thread_idx];
+    const u32 begin = (u32)(range >> 32);
+    u32 end = (u32)range;
+
+    // Leave the upper halves for others to steal.
+    while(end - begin > job_system->grain)
+    {
+        const u32 mid = begin + (end - begin) / 2;
+        job_deque_push(deque, pack_job_range(mid, end));
+        end = mid;
+    }
+
+    job_system->fn(job_system->data, begin, end, thread_idx);
+    atomic_add_s64(&job_system->num_remaining, -(s64)(end - begin));
+}
+
+// Runs and steals ranges until the parallel_for in flight is done.
+static void run_jobs(struct JobSystem* job_system, const u32 thread_idx)
+{
+    const u32 num_threads = job_system->num_threads;
+    while(atomic_load_s64(&job_system->num_remaining) > 0)
+    {
+        u64 range = job_deque_pop(&job_system->deques[thread_idx]);
+        for(u32 i = 1; range == JOB_RANGE_EMPTY && i < num_threads; i++)
+        {
+            range = job_deque_steal(&job_system->deques[(thread_idx + i) % num_threads]);
+        }
+
+        if(range == JOB_RANGE_EMPTY)
+        {
+            _mm_pause();
+            continue;
+        }
+
+        run_job_range(job_system, thread_idx, range);
+    }
+}
+
+static void job_worker_thread(void* data)
+{
+    struct JobWorker* worker = data;
+    for(;;)
+    {
+        platform_wait_semaphore(&worker->job_system->wake_semaphore);
+        run_jobs(worker->job_system, worker->thread_idx);
+    }
+}
+
+void init_job_system(struct JobSystem* job_system, const u32 num_threads)
+{
+    ASSERT(num_threads >= 1 && num_threads <= JOB_SYSTEM_MAX_THREADS, "Invalid thread count %u.", num_threads);
+
+    job_system->num_threads = num_threads;
+    for(u32 i = 0; i < num_threads; i++)
+    {
+        job_system->deques[i].top = 0;
+        job_system->deques[i].bottom = 0;
+    }
+
+    job_system->fn = 0;
+    job_system->data = 0;
+    job_system->grain = 1;
+    job_system->num_remaining = 0;
+
+    platform_init_semaphore(&job_system->wake_semaphore);
+
+    for(u32 i = 1; i < num_threads; i++)
+    {
+        struct JobWorker* worker = &job_system->workers[i];
+        worker->job_system = job_system;
+        worker->thread_idx = i;
+        platform_start_thread(job_worker_thread, worker);
+    }
+}
+
+void parallel_for(
+    struct JobSystem* job_system,
+    const u32 count,
+    const u32 grain,
+    JobFn fn,
+    void* data)
+{
+    ASSERT(grain > 0, "Grain must be at least 1.");
+    ASSERT(atomic_load_s64(&job_system->num_remaining) == 0, "parallel_for is not reentrant.");
+
+    if(count == 0)
+    {
+        return;
+    }
+
+    if(job_system->num_threads == 1 || count <= grain)
+    {
+        fn(data, 0, count, 0);
+        return;
+    }
+
+    job_system->fn = fn;
+    job_system->data = data;
+    job_system->grain = grain;
+    atomic_store_s64(&job_system->num_remaining, count);
+    job_deque_push(&job_system->deques[0], pack_job_range(0, count));
+
+    platform_signal_semaphore(&job_system->wake_semaphore, job_system->num_threads - 1);
+    run_jobs(job_system, 0);
+}
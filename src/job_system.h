@@ -0,0 +1,66 @@
+#pragma once
+
+#include "common.h"
+#include "platform.h"
+
+#define JOB_SYSTEM_MAX_THREADS 16
+#define JOB_DEQUE_SIZE 256
+
+// Runs 'fn' over index ranges on a fixed pool of worker threads.
+//
+// Each thread owns a Chase-Lev deque of [begin, end) ranges. parallel_for pushes the whole range onto the calling
+// thread's deque; whoever picks a range up keeps splitting it in half, pushing the upper half back onto its own
+// deque, until it is no larger than the grain. Idle threads steal the oldest (largest) ranges from the others.
+//
+// Which thread runs which index is not deterministic. For the simulation to stay deterministic regardless of the
+// thread count, a job may only write data owned by the indices it was given, and 'thread_idx' may only be used to
+// pick scratch memory.
+
+typedef void (*JobFn)(void* data, const u32 begin, const u32 end, const u32 thread_idx);
+
+struct JobDeque
+{
+    volatile s64 top;
+    u8 pad_top[56];
+    volatile s64 bottom;
+    u8 pad_bottom[56];
+
+    // [begin, end) packed as begin << 32 | end.
+    volatile u64 ranges[JOB_DEQUE_SIZE];
+};
+
+struct JobWorker
+{
+    struct JobSystem* job_system;
+    u32 thread_idx;
+};
+
+struct JobSystem
+{
+    // Including the thread calling parallel_for, which is always thread 0.
+    u32 num_threads;
+
+    struct JobDeque deques[JOB_SYSTEM_MAX_THREADS];
+    struct JobWorker workers[JOB_SYSTEM_MAX_THREADS];
+
+    // Signalled once per worker when a parallel_for starts.
+    struct PlatformSemaphore wake_semaphore;
+
+    // The parallel_for in flight. Only one runs at a time.
+    JobFn fn;
+    void* data;
+    u32 grain;
+    volatile s64 num_remaining;
+};
+
+// Starts 'num_threads - 1' worker threads. Call once; the threads live until the process exits.
+void init_job_system(struct JobSystem* job_system, const u32 num_threads);
+
+// Calls 'fn' on ranges covering [0, count) exactly once, each at most 'grain' long, and returns when all are done.
+// Must only be called from thread 0, and not from inside a job.
+void parallel_for(
+    struct JobSystem* job_system,
+    const u32 count,
+    const u32 grain,
+    JobFn fn,
+    void* data);
@@ -115,6 +115,12 @@ static inline f32 abs_f32(f32 a)
 ////////////////////////////////////////////////////////////////////////////////
 
 
+////////////////////////////////////////////////////////////////////////////////
+// sign, -1, 0 or 1
+static inline s32 sign_s32(s32 a) { return (a > 0) - (a < 0); }
+////////////////////////////////////////////////////////////////////////////////
+
+
 ////////////////////////////////////////////////////////////////////////////////
 // square
 static inline u8  sq_u8(u8 a)   { return a * a; }
@@ -506,7 +512,7 @@ static inline void mul_m4x4(m4x4* r, m4x4* a, m4x4* b)
 ////////////////////////////////////////////////////////////////////////////////
 
 
-inline u32 rand_u32(u32 n)
+static inline u32 rand_u32(u32 n)
 {
     n ^= n << 13;
     n ^= n >> 17;
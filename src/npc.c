@@ -4,21 +4,14 @@
 #include "game_input.h"
 #include "game_state.h"
 #include "path_find.h"
+#include "wall_grid.h"
 
-void update_npc(
-    struct PlayerInput* player,
+void update_npc_target(
     struct Npc* npc,
-    struct PathFind* path_find,
-    const struct Level* level,
     const struct GameState* game_state,
     const u32 player_id,
     const s64 frame_num)
 {
-    (void)game_state;
-
-    player->move_x = 0.0f;
-    player->move_y = 0.0f;
-
     // if(game_state->player_team_id[player_id] == 0)
     // {
     //     npc->target_pos_x = game_state->player_pos_x[0];
@@ -36,6 +29,371 @@ void update_npc(
         npc->target_pos_x = 0.0f;
         npc->target_pos_y = 0.0f;
     }
+}
+
+// Moves the cursor to the npc's cell if it is still on its path. Returns 0 if the path needs replanning.
+static u8 follow_npc_path(
+    struct Npc* npc,
+    const s32 cell_x,
+    const s32 cell_y,
+    const s32 end_x,
+    const s32 end_y,
+    const u32 player_id,
+    const s64 frame_num)
+{
+    if(!npc->path_len)
+    {
+        return 0;
+    }
+
+    u32 cursor = npc->path_cursor;
+    const u32 last = min_u32(cursor + NPC_PATH_LOOKAHEAD, npc->path_len);
+    while(cursor < last && (npc->path_x[cursor] != cell_x || npc->path_y[cursor] != cell_y))
+    {
+        cursor++;
+    }
+    if(cursor == last)
+    {
+        // Pushed off the path.
+        return 0;
+    }
+    npc->path_cursor = cursor;
+
+    // Keep enough cells ahead to steer and brake with.
+    return
+        npc->path_end_x == end_x &&
+        npc->path_end_y == end_y &&
+        (frame_num + player_id) % NPC_REPLAN_INTERVAL != 0 &&
+        (npc->path_reaches_end || npc->path_len - cursor >= 4);
+}
+
+static void set_npc_path(
+    struct Npc* npc,
+    const s32* path_x,
+    const s32* path_y,
+    const u32 num_path,
+    const struct WallGrid* wall_grid,
+    const struct Level* level,
+    const s32 end_x,
+    const s32 end_y)
+{
+    npc->path_len = min_u32(num_path, NPC_MAX_PATH_LEN);
+    npc->path_cursor = 0;
+    npc->path_end_x = end_x;
+    npc->path_end_y = end_y;
+    COPY(npc->path_x, path_x, npc->path_len);
+    COPY(npc->path_y, path_y, npc->path_len);
+
+    // Searches can stop short of the end (HPA) and only the start of long paths is kept.
+    npc->path_reaches_end = 0;
+    u16 end_idx;
+    if(num_path && num_path <= NPC_MAX_PATH_LEN && get_path_find_end_cell(&end_idx, wall_grid, level, end_x, end_y))
+    {
+        npc->path_reaches_end =
+            path_x[num_path - 1] == (end_idx & 0xFF) - (s32)level->width / 2 &&
+            path_y[num_path - 1] == (end_idx >> 8) - (s32)level->height / 2;
+    }
+}
+
+void init_npc_path_scheduler(struct NpcPathScheduler* scheduler)
+{
+    for(u32 i = 0; i < NPC_PATH_NUM_LANES; i++)
+    {
+        struct NpcPathLane* lane = &scheduler->lanes[i];
+        init_path_find(&lane->path_find);
+        lane->is_searching = 0;
+        lane->hpa_max_work = 0;
+        lane->num_batch = 0;
+        lane->queue_first = 0;
+        lane->num_queue = 0;
+    }
+}
+
+static inline u8 has_same_npc_request_end(const struct Npc* a, const struct Npc* b)
+{
+    return a->request_end_x == b->request_end_x && a->request_end_y == b->request_end_y;
+}
+
+// The lane that already has an npc queued for the same end as 'npc', if any.
+static struct NpcPathLane* find_npc_path_lane(struct NpcPathScheduler* scheduler, const struct Npc* npcs, const struct Npc* npc)
+{
+    for(u32 i_lane = 0; i_lane < NPC_PATH_NUM_LANES; i_lane++)
+    {
+        struct NpcPathLane* lane = &scheduler->lanes[i_lane];
+        for(u32 i = 0; i < lane->num_queue; i++)
+        {
+            if(has_same_npc_request_end(&npcs[lane->queue[(lane->queue_first + i) % ARRAY_COUNT(lane->queue)]], npc))
+            {
+                return lane;
+            }
+        }
+    }
+    return NULL;
+}
+
+// Searches the next npc on the lane together with the other queued npcs heading for the same end, taking them off the
+// queue, or goes on with the batch in progress. Returns 0, and does nothing, if there is no batch and the next npc is
+// the only one heading for its end.
+static u8 run_npc_path_batch(
+    struct NpcPathLane* lane,
+    struct Npc* npcs,
+    u32* r_budget,
+    const enum PathFindMode path_find_mode,
+    const struct WallGrid* wall_grid,
+    const struct Level* level)
+{
+    if(!lane->num_batch)
+    {
+        const struct Npc* first_npc = &npcs[lane->queue[lane->queue_first]];
+        u32 num_same_end = 0;
+        for(u32 i = 0; i < lane->num_queue; i++)
+        {
+            num_same_end += has_same_npc_request_end(&npcs[lane->queue[(lane->queue_first + i) % ARRAY_COUNT(lane->queue)]], first_npc);
+        }
+        if(num_same_end < 2)
+        {
+            return 0;
+        }
+
+        // Take the batch out, keeping the rest of the queue in order.
+        u32 num_queue = 0;
+        for(u32 i = 0; i < lane->num_queue; i++)
+        {
+            const u16 npc_idx = lane->queue[(lane->queue_first + i) % ARRAY_COUNT(lane->queue)];
+            const struct Npc* npc = &npcs[npc_idx];
+            if(lane->num_batch < NPC_PATH_MAX_BATCH && has_same_npc_request_end(npc, first_npc))
+            {
+                struct PathFindRequest* request = &lane->batch_requests[lane->num_batch];
+                request->start_x = npc->request_start_x;
+                request->start_y = npc->request_start_y;
+                request->end_x = npc->request_end_x;
+                request->end_y = npc->request_end_y;
+                lane->batch_npcs[lane->num_batch] = npc_idx;
+                lane->num_batch++;
+            }
+            else
+            {
+                lane->queue[(lane->queue_first + num_queue) % ARRAY_COUNT(lane->queue)] = npc_idx;
+                num_queue++;
+            }
+        }
+        lane->num_queue = num_queue;
+        lane->is_searching = 0;
+    }
+
+    // Also restarts the batch after invalidate_npc_paths.
+    if(!lane->is_searching)
+    {
+        start_path_find_batch(
+            &lane->batch, lane->batch_path_len, path_find_mode, lane->batch_requests, lane->num_batch, wall_grid, level);
+        lane->is_searching = 1;
+    }
+    const enum PathFindStatus status = resume_path_find_batch(
+        &lane->batch,
+        &lane->path_find,
+        lane->batch_path_x,
+        lane->batch_path_y,
+        lane->batch_path_len,
+        NPC_MAX_PATH_LEN,
+        wall_grid,
+        level,
+        r_budget);
+    if(status == PATH_FIND_STATUS_SEARCHING)
+    {
+        return 1;
+    }
+
+    // The npcs may have moved their targets since, so each path is handed out with the end it was searched for.
+    for(u32 i = 0; i < lane->num_batch; i++)
+    {
+        struct Npc* npc = &npcs[lane->batch_npcs[i]];
+        set_npc_path(
+            npc,
+            lane->batch_path_x + i * NPC_MAX_PATH_LEN,
+            lane->batch_path_y + i * NPC_MAX_PATH_LEN,
+            lane->batch_path_len[i],
+            wall_grid,
+            level,
+            lane->batch_requests[i].end_x,
+            lane->batch_requests[i].end_y);
+        npc->path_queued = 0;
+    }
+    lane->num_batch = 0;
+    lane->is_searching = 0;
+    return 1;
+}
+
+void schedule_npc_paths(struct NpcPathScheduler* scheduler, struct Npc* npcs, const u32 num_npcs)
+{
+    for(u32 i = 0; i < num_npcs; i++)
+    {
+        struct Npc* npc = &npcs[i];
+        if(!npc->path_requested || npc->path_queued)
+        {
+            npc->path_requested = 0;
+            continue;
+        }
+        npc->path_requested = 0;
+        npc->path_queued = 1;
+
+        struct NpcPathLane* lane = find_npc_path_lane(scheduler, npcs, npc);
+        if(!lane)
+        {
+            lane = &scheduler->lanes[0];
+            for(u32 i_lane = 1; i_lane < NPC_PATH_NUM_LANES; i_lane++)
+            {
+                lane = scheduler->lanes[i_lane].num_queue < lane->num_queue ? &scheduler->lanes[i_lane] : lane;
+            }
+        }
+        ASSERT(lane->num_queue < ARRAY_COUNT(lane->queue), "Npc path queue overflow.");
+        lane->queue[(lane->queue_first + lane->num_queue) % ARRAY_COUNT(lane->queue)] = (u16)i;
+        lane->num_queue++;
+    }
+}
+
+void run_npc_path_lane(
+    struct NpcPathLane* lane,
+    struct Npc* npcs,
+    u32 budget,
+    const enum PathFindMode path_find_mode,
+    const struct PathFindClusters* path_find_clusters,
+    const struct WallGrid* wall_grid,
+    const struct Level* level)
+{
+    s32 path_x[MAX_PATH_LEN];
+    s32 path_y[MAX_PATH_LEN];
+    const u32 full_budget = budget;
+
+    while((lane->num_queue || lane->num_batch) && budget)
+    {
+        if(path_find_mode != PATH_FIND_MODE_HPA &&
+           (lane->num_batch || !lane->is_searching) &&
+           run_npc_path_batch(lane, npcs, &budget, path_find_mode, wall_grid, level))
+        {
+            continue;
+        }
+
+        struct Npc* npc = &npcs[lane->queue[lane->queue_first]];
+        u32 num_path = 0;
+
+        if(path_find_mode == PATH_FIND_MODE_HPA)
+        {
+            // Not resumable, so it runs whole, and only if the rest of the budget is likely to cover it.
+            if(budget < full_budget && budget < lane->hpa_max_work)
+            {
+                break;
+            }
+            u32 work = 0;
+            num_path = run_path_find_hpa(
+                &lane->path_find,
+                &work,
+                path_x,
+                path_y,
+                path_find_clusters,
+                wall_grid,
+                level,
+                npc->request_start_x,
+                npc->request_start_y,
+                npc->request_end_x,
+                npc->request_end_y);
+            budget -= min_u32(budget, work);
+            lane->hpa_max_work = max_u32(lane->hpa_max_work, work);
+        }
+        else
+        {
+            // Restart if the target moved since the search started. A moved start only costs a replan later.
+            if(lane->is_searching && (lane->search_end_x != npc->request_end_x || lane->search_end_y != npc->request_end_y))
+            {
+                lane->is_searching = 0;
+            }
+
+            enum PathFindStatus status = PATH_FIND_STATUS_NO_PATH;
+            if(lane->is_searching ||
+               start_path_find(
+                   &lane->path_find,
+                   path_find_mode,
+                   wall_grid,
+                   level,
+                   npc->request_start_x,
+                   npc->request_start_y,
+                   npc->request_end_x,
+                   npc->request_end_y))
+            {
+                if(!lane->is_searching)
+                {
+                    lane->is_searching = 1;
+                    lane->search_end_x = npc->request_end_x;
+                    lane->search_end_y = npc->request_end_y;
+                }
+                status = resume_path_find(&lane->path_find, wall_grid, &budget);
+            }
+
+            if(status == PATH_FIND_STATUS_SEARCHING)
+            {
+                break;
+            }
+            if(status == PATH_FIND_STATUS_DONE)
+            {
+                num_path = get_path_find_result(&lane->path_find, path_x, path_y, level);
+            }
+            lane->is_searching = 0;
+        }
+
+        set_npc_path(npc, path_x, path_y, num_path, wall_grid, level, npc->request_end_x, npc->request_end_y);
+        npc->path_queued = 0;
+        lane->queue_first = (lane->queue_first + 1) % ARRAY_COUNT(lane->queue);
+        lane->num_queue--;
+    }
+}
+
+void invalidate_npc_paths(
+    struct NpcPathScheduler* scheduler,
+    struct Npc* npcs,
+    const u32 num_npcs,
+    const s32 x,
+    const s32 y,
+    const u32 w,
+    const u32 h,
+    const u8 is_wall)
+{
+    // A search in progress may have settled cells through the change.
+    for(u32 i = 0; i < NPC_PATH_NUM_LANES; i++)
+    {
+        scheduler->lanes[i].is_searching = 0;
+    }
+
+    if(!is_wall)
+    {
+        return;
+    }
+    for(u32 i = 0; i < num_npcs; i++)
+    {
+        struct Npc* npc = &npcs[i];
+        for(u32 j = npc->path_cursor; j < npc->path_len; j++)
+        {
+            if(npc->path_x[j] >= x && npc->path_x[j] < x + (s32)w && npc->path_y[j] >= y && npc->path_y[j] < y + (s32)h)
+            {
+                npc->path_len = 0;
+                npc->path_cursor = 0;
+                break;
+            }
+        }
+    }
+}
+
+void update_npc(
+    struct PlayerInput* player,
+    struct Npc* npc,
+    const struct FlowField* flow_field,
+    const u8 is_flow_field_pending,
+    const struct WallGrid* wall_grid,
+    const struct Level* level,
+    const struct GameState* game_state,
+    const u32 player_id,
+    const s64 frame_num)
+{
+    player->move_x = 0.0f;
+    player->move_y = 0.0f;
 
     const v2 player_pos = make_v2(game_state->player_pos_x[player_id], game_state->player_pos_y[player_id]);
 
@@ -43,32 +401,81 @@ void update_npc(
     s32 start_y = (s32)round_neg_inf(player_pos.y);
     s32 end_x   = (s32)round_neg_inf(npc->target_pos_x);
     s32 end_y   = (s32)round_neg_inf(npc->target_pos_y);
-    s32 path_x[MAX_PATH_LEN];
-    s32 path_y[MAX_PATH_LEN];
-    const u32 num_path = run_path_find(
-        path_find,
-        path_x,
-        path_y,
-        level,
-        start_x,
-        start_y,
-        end_x,
-        end_y);
+
+    // The rest of the path from the npc's cell.
+    const s32* path_x;
+    const s32* path_y;
+    u32 num_path = 0;
+    u8 reaches_end = 0;
+    s32 field_path_x[4];
+    s32 field_path_y[4];
+    if(flow_field)
+    {
+        // Only the first few cells are looked at below.
+        num_path = follow_flow_field(flow_field, field_path_x, field_path_y, 4, wall_grid, level, start_x, start_y);
+
+        // A field that is being rebuilt after a wall change can still lead into cells that have become walls since.
+        // The npc goes back to its own path until the rebuilt field is ready.
+        for(u32 i = 1; i < num_path; i++)
+        {
+            if(is_wall_grid_cell(wall_grid, field_path_x[i], field_path_y[i]))
+            {
+                flow_field = NULL;
+                break;
+            }
+        }
+    }
+    if(flow_field)
+    {
+        path_x = field_path_x;
+        path_y = field_path_y;
+        reaches_end = num_path < 4;
+        npc->path_len = 0;
+    }
+    else
+    {
+        if(!follow_npc_path(npc, start_x, start_y, end_x, end_y, player_id, frame_num) && !is_flow_field_pending)
+        {
+            npc->path_requested = 1;
+            npc->request_start_x = start_x;
+            npc->request_start_y = start_y;
+            npc->request_end_x = end_x;
+            npc->request_end_y = end_y;
+        }
+        num_path = npc->path_len - npc->path_cursor;
+        reaches_end = npc->path_reaches_end;
+        path_x = npc->path_x + npc->path_cursor;
+        path_y = npc->path_y + npc->path_cursor;
+    }
+
     if(num_path)
     {
-        const v2 next_pos =
-            num_path > 1
-            ? make_v2((f32)path_x[1] + 0.5f, (f32)path_y[1] + 0.5f)
-            : make_v2((f32)path_x[0] + 0.5f, (f32)path_y[0] + 0.5f);
+        // String pull: skip ahead to the furthest cell the npc can move to in a straight line without touching a wall.
+        u32 next = num_path > 1 ? 1 : 0;
+        for(u32 i = min_u32(num_path, NPC_SMOOTH_LOOKAHEAD) - 1; i > next; i--)
+        {
+            if(!wall_grid_intersect_circle_sweep(
+                wall_grid,
+                player_pos.x,
+                player_pos.y,
+                (f32)path_x[i] + 0.5f,
+                (f32)path_y[i] + 0.5f,
+                PLAYER_RADIUS))
+            {
+                next = i;
+                break;
+            }
+        }
+        const v2 next_pos = make_v2((f32)path_x[next] + 0.5f, (f32)path_y[next] + 0.5f);
 
         v2 dir = sub_v2(next_pos, player_pos);
         f32 len = length_v2(dir);
         dir = normalize_or_v2(dir, zero_v2());
 
         // Put on the brakes.
-        if(num_path == 3) dir = scale_v2(dir, 0.6f);
-        if(num_path == 2) dir = scale_v2(dir, 0.4f);
-        if(num_path == 1)
+        if(reaches_end && num_path == 3) dir = scale_v2(dir, 0.6f);
+        if(reaches_end && num_path == 2) dir = scale_v2(dir, 0.4f);
+        if(reaches_end && num_path == 1)
         {
             dir = scale_v2(dir, 3.0f*sq_f32(len) - 2.0f*sq_f32(len)*len);
             dir = scale_v2(dir, 0.3f);
@@ -3,21 +3,135 @@
 
 #include "common.h"
 #include "constants.h"
+#include "path_find.h"
+
+// Cells of the planned path each npc keeps. Paths are replanned before the npc runs out of them.
+#define NPC_MAX_PATH_LEN 64
+// How far ahead along its path an npc is looked for when it is not on the cell it was on.
+#define NPC_PATH_LOOKAHEAD 4
+// Npcs steer for the furthest of this many path cells they can reach in a straight line.
+#define NPC_SMOOTH_LOOKAHEAD 8
+// Paths are replanned at least this often, on frames spread out by player id.
+#define NPC_REPLAN_INTERVAL 64
+
+// Npc path searches run on this many lanes, each with its own search in progress.
+#define NPC_PATH_NUM_LANES 4
+// Search work per tick over all lanes, see resume_path_find. A* and JPS searches stop within it, give or take the last
+// expansion on each lane. HPA queries cannot be suspended, so a lane only starts one while what is left of its share
+// covers the most its queries have cost so far, or when it has not spent any of it yet this tick.
+#define NPC_PATH_BUDGET 4096
+// Queued npcs heading for the same cell are searched together as one PathFindBatch, up to this many at a time. Large
+// enough for a JPS batch to share one search, see PATH_FIND_BATCH_MIN_SHARED_JPS.
+#define NPC_PATH_MAX_BATCH MAX_PATH_FIND_BATCH
 
 struct Npc
 {
     f32 target_pos_x;
     f32 target_pos_y;
+
+    // Start of the last planned path, in level cells, and the cell the npc is on. The path is replanned when the
+    // target cell changes, the npc strays off the path, the kept cells run out, or the replan timer expires.
+    u32 path_len;
+    u32 path_cursor;
+    u8 path_reaches_end;
+    s32 path_end_x;
+    s32 path_end_y;
+    s32 path_x[NPC_MAX_PATH_LEN];
+    s32 path_y[NPC_MAX_PATH_LEN];
+
+    // Set by update_npc when the path needs replanning. The search runs later on an NpcPathLane, meanwhile the npc
+    // keeps following its old path.
+    u8 path_requested;
+    u8 path_queued;
+    s32 request_start_x;
+    s32 request_start_y;
+    s32 request_end_x;
+    s32 request_end_y;
+};
+
+// A queue of npcs waiting for a path. The search for the first one is in 'path_find' and may take several ticks.
+struct NpcPathLane
+{
+    struct PathFind path_find;
+    u8 is_searching;
+    // Most work any HPA query on this lane has taken, what the next one is expected to cost at worst.
+    u32 hpa_max_work;
+    s32 search_end_x;
+    s32 search_end_y;
+
+    u32 queue_first;
+    u32 num_queue;
+    u16 queue[MAX_PLAYERS];
+
+    // The batch in progress, taken off the queue. While num_batch is nonzero is_searching is about the batch.
+    u32 num_batch;
+    struct PathFindBatch batch;
+    struct PathFindRequest batch_requests[NPC_PATH_MAX_BATCH];
+    u16 batch_npcs[NPC_PATH_MAX_BATCH];
+    u32 batch_path_len[NPC_PATH_MAX_BATCH];
+    s32 batch_path_x[NPC_PATH_MAX_BATCH * NPC_MAX_PATH_LEN];
+    s32 batch_path_y[NPC_PATH_MAX_BATCH * NPC_MAX_PATH_LEN];
+};
+
+struct NpcPathScheduler
+{
+    struct NpcPathLane lanes[NPC_PATH_NUM_LANES];
 };
 
 struct PlayerInput;
 struct GameState;
 struct PathFind;
+struct WallGrid;
 struct Level;
+
+// Rerolls or resets the target. Runs before the npcs' update_npc so that npcs sharing a target can share a
+// FlowField.
+void update_npc_target(
+    struct Npc* npc,
+    const struct GameState* game_state,
+    const u32 player_id,
+    const s64 frame_num);
+
+void init_npc_path_scheduler(struct NpcPathScheduler* scheduler);
+
+// Queues the npcs that requested a path since the last call, in npc order. An npc goes on a lane that already has an
+// npc heading for the same cell, so that they can be searched together, otherwise on the lane with the shortest queue.
+void schedule_npc_paths(struct NpcPathScheduler* scheduler, struct Npc* npcs, const u32 num_npcs);
+
+// Runs the searches queued on one lane, within 'budget' work, and hands the finished paths to their npcs. Npcs queued
+// for the same cell as the next one are searched with it in one PathFindBatch, which is charged as it goes and hands
+// out its paths once it is done. Lanes only touch their own npcs, so they can run on different threads.
+void run_npc_path_lane(
+    struct NpcPathLane* lane,
+    struct Npc* npcs,
+    const u32 budget,
+    const enum PathFindMode path_find_mode,
+    const struct PathFindClusters* path_find_clusters,
+    const struct WallGrid* wall_grid,
+    const struct Level* level);
+
+// Call after the walls in the level space box [x, x + w) x [y, y + h) changed. Drops the npc paths that now run
+// through new walls and restarts the searches in progress. Paths that opened cells could shorten are kept until
+// their next replan.
+void invalidate_npc_paths(
+    struct NpcPathScheduler* scheduler,
+    struct Npc* npcs,
+    const u32 num_npcs,
+    const s32 x,
+    const s32 y,
+    const u32 w,
+    const u32 h,
+    const u8 is_wall);
+
+// 'flow_field' leads to the npc's target if there is one, otherwise the npc follows its own path. So does an npc whose
+// next few cells along the field have become walls since it was built. While 'is_flow_field_pending' a field for the
+// target is still being built, and the npc keeps to the path it has instead of asking for a new one.
 void update_npc(
     struct PlayerInput* player,
     struct Npc* npc,
-    struct PathFind* path_find,
+    const struct FlowField* flow_field,
+    const u8 is_flow_field_pending,
+    const struct WallGrid* wall_grid,
     const struct Level* level,
     const struct GameState* game_state,
     const u32 player_id,
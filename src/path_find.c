@@ -5,69 +5,180 @@
 
 #include "debug_draw.h"
 
-static void path_find_set_wall(struct PathFind* path_find, u8 bl_x, u8 bl_y, u16 w, u16 h)
+static u8 is_open_cell(const struct WallGrid* wall_grid, const u8 x, const u8 y)
 {
-    for(u64 y = bl_y; y < bl_y + h; y++)
+    const u64 idx = (u64)y * 256ULL + (u64)x;
+    const u64 byte = idx / 8;
+    const u64 bit = idx % 8;
+    return !(wall_grid->grid[byte] & (1ULL << bit));
+}
+
+static inline u8 is_wall_cell(const struct WallGrid* wall_grid, const s32 x, const s32 y)
+{
+    return x < 0 || x >= 256 || y < 0 || y >= 256 || !is_open_cell(wall_grid, (u8)x, (u8)y);
+}
+
+// Agents are as wide as a cell, so a diagonal step must not cut a wall corner: both cells beside it must be open.
+static inline u8 can_step_diagonally(const struct WallGrid* wall_grid, const s32 x, const s32 y, const s32 dx, const s32 dy)
+{
+    return
+        !is_wall_cell(wall_grid, x + dx, y + dy) &&
+        !is_wall_cell(wall_grid, x + dx, y) &&
+        !is_wall_cell(wall_grid, x, y + dy);
+}
+
+void init_path_find(struct PathFind* path_find)
+{
+    path_find->num_open_list = 0;
+    path_find->search_id = 0;
+    ZERO_ARRAY(path_find->grid_search_id);
+}
+
+static inline u8 is_visited_cell(const struct PathFind* path_find, const u16 cell_idx)
+{
+    return path_find->grid_search_id[cell_idx] == path_find->search_id;
+}
+
+// The open list is a 4-ary min heap on f = g + h. grid_open_idx tracks where each open cell sits in the heap so a
+// cheaper path to it can decrease its key in place instead of adding a duplicate.
+
+static inline void open_list_set(struct PathFind* path_find, const u32 i, const u16 cell_idx, const u32 f_dist)
+{
+    path_find->open_list[i] = cell_idx;
+    path_find->open_list_f_dist[i] = f_dist;
+    path_find->grid_open_idx[cell_idx] = i;
+}
+
+static void open_list_sift_up(struct PathFind* path_find, u32 i)
+{
+    const u16 cell_idx = path_find->open_list[i];
+    const u32 f_dist = path_find->open_list_f_dist[i];
+    while(i > 0)
     {
-        for(u64 x = bl_x; x < bl_x + w; x++)
+        const u32 parent = (i - 1) / 4;
+        if(path_find->open_list_f_dist[parent] <= f_dist)
         {
-            const u64 idx = y * 256ULL + x;
-            const u64 byte = idx / 8;
-            const u64 bit = idx % 8;
-            path_find->grid[byte] |= 1ULL << bit;
+            break;
         }
+        open_list_set(path_find, i, path_find->open_list[parent], path_find->open_list_f_dist[parent]);
+        i = parent;
     }
+    open_list_set(path_find, i, cell_idx, f_dist);
 }
 
-static u8 is_open_cell(const struct PathFind* path_find, const u8 x, const u8 y)
+static void open_list_sift_down(struct PathFind* path_find, u32 i)
 {
-    const u64 idx = (u64)y * 256ULL + (u64)x;
-    const u64 byte = idx / 8;
-    const u64 bit = idx % 8;
-    return !(path_find->grid[byte] & (1ULL << bit));
+    const u32 num_open_list = path_find->num_open_list;
+    const u16 cell_idx = path_find->open_list[i];
+    const u32 f_dist = path_find->open_list_f_dist[i];
+    while(1)
+    {
+        const u32 first_child = i * 4 + 1;
+        if(first_child >= num_open_list)
+        {
+            break;
+        }
+
+        const u32 last_child = min_u32(first_child + 4, num_open_list);
+        u32 i_min = first_child;
+        for(u32 child = first_child + 1; child < last_child; child++)
+        {
+            i_min = path_find->open_list_f_dist[child] < path_find->open_list_f_dist[i_min] ? child : i_min;
+        }
+        if(path_find->open_list_f_dist[i_min] >= f_dist)
+        {
+            break;
+        }
+        open_list_set(path_find, i, path_find->open_list[i_min], path_find->open_list_f_dist[i_min]);
+        i = i_min;
+    }
+    open_list_set(path_find, i, cell_idx, f_dist);
 }
 
-void init_path_find(struct PathFind* path_find, 
-                    const struct Level* level)
+static void open_list_push(struct PathFind* path_find, const u16 cell_idx, const u32 f_dist)
 {
-    ZERO_ARRAY(path_find->grid);
+    ASSERT(path_find->num_open_list < ARRAY_COUNT(path_find->open_list), "Path find open list overflow.");
+    const u32 i = path_find->num_open_list++;
+    open_list_set(path_find, i, cell_idx, f_dist);
+    open_list_sift_up(path_find, i);
+}
 
-    const s32 level_hw = level->width / 2;
-    const s32 level_hh = level->height / 2;
-    for(u64 i = 0; i < level->num_walls; i++)
-    {
-        const struct LevelWallGeometry* wall = &level->walls[i];
-        const s32 gx0 = clamp_s32(level_hw + wall->x,           0, 255);
-        const s32 gx1 = clamp_s32(level_hw + wall->x + wall->w, 0, 255);
-        const s32 gy0 = clamp_s32(level_hh + wall->y,           0, 255);
-        const s32 gy1 = clamp_s32(level_hh + wall->y + wall->h, 0, 255);
+static u16 open_list_pop(struct PathFind* path_find)
+{
+    const u16 cell_idx = path_find->open_list[0];
+    path_find->grid_open_idx[cell_idx] = PATH_FIND_NOT_OPEN;
 
-        path_find_set_wall(path_find, (u8)gx0, (u8)gy0, (u8)(gx1 - gx0), (u8)(gy1 - gy0));
+    const u32 last = --path_find->num_open_list;
+    if(last > 0)
+    {
+        open_list_set(path_find, 0, path_find->open_list[last], path_find->open_list_f_dist[last]);
+        open_list_sift_down(path_find, 0);
     }
+    return cell_idx;
 }
 
-u32 run_path_find(
+// Records a cheaper path to 'cell_idx' through 'prev_idx'.
+static void path_find_relax(
     struct PathFind* path_find,
-    s32* r_path_x,
-    s32* r_path_y,
+    const u16 cell_idx,
+    const u16 prev_idx,
+    const u32 dist,
+    const u32 f_dist,
+    const u8 was_visited)
+{
+    path_find->grid_search_id[cell_idx] = path_find->search_id;
+    path_find->grid_dist[cell_idx] = dist;
+    path_find->grid_prev[cell_idx] = prev_idx;
+
+    const u32 open_idx = was_visited ? path_find->grid_open_idx[cell_idx] : PATH_FIND_NOT_OPEN;
+    if(open_idx == PATH_FIND_NOT_OPEN)
+    {
+        // The heuristic is consistent, so closed cells are never improved on.
+        ASSERT(!was_visited, "Path find reopened a closed cell.");
+        open_list_push(path_find, cell_idx, f_dist);
+    }
+    else
+    {
+        path_find->open_list_f_dist[open_idx] = f_dist;
+        open_list_sift_up(path_find, open_idx);
+    }
+}
+
+// Forgets the previous search and opens 'start_idx'.
+static void start_search(struct PathFind* path_find, const u16 start_idx)
+{
+    path_find->num_open_list = 0;
+    path_find->search_id++;
+    if(path_find->search_id == 0)
+    {
+        // Wrapped, forget every old search.
+        ZERO_ARRAY(path_find->grid_search_id);
+        path_find->search_id = 1;
+    }
+
+    path_find->grid_search_id[start_idx] = path_find->search_id;
+    path_find->grid_dist[start_idx] = 0;
+    path_find->grid_prev[start_idx] = start_idx;
+    open_list_push(path_find, start_idx, 0);
+}
+
+// Maps the level space end to a grid cell, moving it out of walls. Returns 0 if there is no open end cell.
+static u8 find_end_cell(
+    u8* r_grid_end_x,
+    u8* r_grid_end_y,
+    const struct WallGrid* wall_grid,
     const struct Level* level,
-    const s32 start_x,
-    const s32 start_y,
     const s32 end_x,
     const s32 end_y)
 {
     const s32 level_hw = level->width / 2;
     const s32 level_hh = level->height / 2;
-    const u8 grid_start_x = (u8)(clamp_s32(start_x, -level_hw, level_hw - 1) + level_hw);
-    const u8 grid_start_y = (u8)(clamp_s32(start_y, -level_hh, level_hh - 1) + level_hh);
     const u8 maybe_grid_end_x = (u8)(clamp_s32(end_x, -level_hw, level_hw - 1) + level_hw);
     const u8 maybe_grid_end_y = (u8)(clamp_s32(end_y, -level_hh, level_hh - 1) + level_hh);
 
-    ASSERT(is_open_cell(path_find, grid_start_x, grid_start_y), "Invalid starting cell for path_find.");
-
     u8 grid_end_x = maybe_grid_end_x;
     u8 grid_end_y = maybe_grid_end_y;
-    if(!is_open_cell(path_find, maybe_grid_end_x, maybe_grid_end_y))
+    if(!is_open_cell(wall_grid, maybe_grid_end_x, maybe_grid_end_y))
     {
         u32 found = 0;
         const s32 dirs[4][2] = {
@@ -84,7 +195,7 @@ u32 run_path_find(
                 s32 test_x = (s32)maybe_grid_end_x + dirs[i_dir][0] * iter;
                 s32 test_y = (s32)maybe_grid_end_y + dirs[i_dir][1] * iter;
 
-                if(test_x >= 0 && test_x < 256 && is_open_cell(path_find, (u8)test_x, (u8)test_y))
+                if(test_x >= 0 && test_x < 256 && is_open_cell(wall_grid, (u8)test_x, (u8)test_y))
                 {
                     grid_end_x = (u8)test_x;
                     grid_end_y = (u8)test_y;
@@ -104,275 +215,1573 @@ u32 run_path_find(
         }
     }
 
-    path_find->num_open_list = 0;
-    for(u64 i = 0; i < ARRAY_COUNT(path_find->grid_dist); i++)
+    *r_grid_end_x = grid_end_x;
+    *r_grid_end_y = grid_end_y;
+    return 1;
+}
+
+// Maps the level space start to a grid cell. A start in a wall, where an npc can be when cells are turned into walls
+// under it by set_wall_grid_cells, is moved out like an end.
+static u16 find_start_cell(const struct WallGrid* wall_grid, const struct Level* level, const s32 start_x, const s32 start_y)
+{
+    const s32 level_hw = level->width / 2;
+    const s32 level_hh = level->height / 2;
+    ASSERT(wall_grid->origin_x == -level_hw && wall_grid->origin_y == -level_hh, "Wall grid does not match the level.");
+
+    u8 grid_start_x = (u8)(clamp_s32(start_x, -level_hw, level_hw - 1) + level_hw);
+    u8 grid_start_y = (u8)(clamp_s32(start_y, -level_hh, level_hh - 1) + level_hh);
+    if(!is_open_cell(wall_grid, grid_start_x, grid_start_y))
+    {
+        find_end_cell(&grid_start_x, &grid_start_y, wall_grid, level, start_x, start_y);
+    }
+
+    return (u16)((u64)grid_start_y * 256ULL + (u64)grid_start_x);
+}
+
+// Maps the level space start and end to grid cells, moves the end out of walls, and starts a new search from the
+// start cell. Returns 0 if there is no open end cell.
+static u8 begin_path_find(
+    struct PathFind* path_find,
+    u8* r_grid_start_x,
+    u8* r_grid_start_y,
+    u8* r_grid_end_x,
+    u8* r_grid_end_y,
+    const struct WallGrid* wall_grid,
+    const struct Level* level,
+    const s32 start_x,
+    const s32 start_y,
+    const s32 end_x,
+    const s32 end_y)
+{
+    const u16 start_idx = find_start_cell(wall_grid, level, start_x, start_y);
+    if(!find_end_cell(r_grid_end_x, r_grid_end_y, wall_grid, level, end_x, end_y))
     {
-        path_find->grid_dist[i] = s32_MAX;
+        return 0;
     }
 
+    *r_grid_start_x = (u8)(start_idx & 0xFF);
+    *r_grid_start_y = (u8)(start_idx >> 8);
+
+    start_search(path_find, start_idx);
+
+    return 1;
+}
+
+u8 get_path_find_end_cell(
+    u16* r_cell_idx,
+    const struct WallGrid* wall_grid,
+    const struct Level* level,
+    const s32 end_x,
+    const s32 end_y)
+{
+    u8 grid_end_x, grid_end_y;
+    if(!find_end_cell(&grid_end_x, &grid_end_y, wall_grid, level, end_x, end_y))
     {
-        const u8 cur_x = grid_start_x;
-        const u8 cur_y = grid_start_y;
-        const u16 cur_idx = (u16)((u64)cur_y * 256ULL + (u64)cur_x);
-        path_find->num_open_list = 1;
-        path_find->open_list[0] = cur_idx;
-        path_find->open_list_f_dist[0] = 0;
-        path_find->grid_dist[cur_idx] = 0;
-        path_find->grid_prev[cur_idx] = cur_idx;
+        return 0;
     }
+    *r_cell_idx = (u16)((u32)grid_end_y * 256 + grid_end_x);
+    return 1;
+}
+
+// Writes the path ending in 'end_idx' to r_path_x/r_path_y in level space, start first. Consecutive cells in the
+// grid_prev chain may be further apart than one step as long as they are on a straight or diagonal line, as in jump
+// point search; the cells between them are filled in.
+static u32 write_path(
+    const struct PathFind* path_find,
+    s32* r_path_x,
+    s32* r_path_y,
+    const struct Level* level,
+    const u16 end_idx)
+{
+    const s32 level_hw = level->width / 2;
+    const s32 level_hh = level->height / 2;
 
+    u32 r_num_path = 0;
+    s32 x = end_idx & 0xFF;
+    s32 y = end_idx >> 8;
+    u16 rewind_idx = end_idx;
     while(1)
     {
-        u32 num_open_list = path_find->num_open_list;
+        const u16 prev_idx = path_find->grid_prev[rewind_idx];
+        const s32 prev_x = prev_idx & 0xFF;
+        const s32 prev_y = prev_idx >> 8;
+        const s32 step_x = sign_s32(prev_x - x);
+        const s32 step_y = sign_s32(prev_y - y);
+        ASSERT(prev_x == x || prev_y == y || abs_s32(prev_x - x) == abs_s32(prev_y - y), "Path link is not a line.");
 
-        if(num_open_list == 0)
+        // The start cell is its own prev.
+        if(prev_idx == rewind_idx)
         {
-            return 0;
+            ASSERT(r_num_path < MAX_PATH_LEN, "Path find result path overflow.");
+            r_path_x[r_num_path] = x - level_hw;
+            r_path_y[r_num_path] = y - level_hh;
+            r_num_path++;
+            break;
+        }
+
+        // Every cell from here up to, not including, prev.
+        do
+        {
+            ASSERT(r_num_path < MAX_PATH_LEN, "Path find result path overflow.");
+            r_path_x[r_num_path] = x - level_hw;
+            r_path_y[r_num_path] = y - level_hh;
+            r_num_path++;
+            x += step_x;
+            y += step_y;
         }
+        while(x != prev_x || y != prev_y);
+
+        rewind_idx = prev_idx;
+    }
+
+    for(u64 i = 0; i < r_num_path / 2; i++)
+    {
+        swap_s32(&r_path_x[i], &r_path_x[r_num_path - 1 - i]);
+        swap_s32(&r_path_y[i], &r_path_y[r_num_path - 1 - i]);
+    }
+
+    return r_num_path;
+}
+
+// Expands one cell of an A* search.
+static void expand_astar(struct PathFind* path_find, const struct WallGrid* wall_grid, const u16 cur_idx)
+{
+    const u8 cur_x = (u8)((cur_idx >> 0U) & 0xFF);
+    const u8 cur_y = (u8)((cur_idx >> 8U) & 0xFF);
+    const u32 cur_dist = path_find->grid_dist[cur_idx];
+    const u8 grid_end_x = (u8)(path_find->end_idx & 0xFF);
+    const u8 grid_end_y = (u8)(path_find->end_idx >> 8);
+
+    #if 1
+    {
+        const __m256i cur_x8 = _mm256_set1_epi32(cur_x);
+        const __m256i cur_y8 = _mm256_set1_epi32(cur_y);
+        const __m256i cur_dist8 = _mm256_set1_epi32(cur_dist);
+    
+        const __m256i n_x = _mm256_add_epi32(cur_x8, _mm256_setr_epi32(-1,  0,  1, -1,  1, -1,  0,  1));
+        const __m256i n_y = _mm256_add_epi32(cur_y8, _mm256_setr_epi32(-1, -1, -1,  0,  0,  1,  1,  1));
+        const __m256i n_idx = _mm256_add_epi32(_mm256_slli_epi32(n_y, 8), n_x);
+        const __m256i n_dist = _mm256_add_epi32(cur_dist8, _mm256_setr_epi32(1500, 1000, 1500, 1000, 1000, 1500, 1000, 1500));
+
+        const __m256i grid_end_x8 = _mm256_set1_epi32(grid_end_x);
+        const __m256i grid_end_y8 = _mm256_set1_epi32(grid_end_y);
+        __m256i n_hdist = 
+            _mm256_max_epi32(
+                _mm256_abs_epi32(_mm256_sub_epi32(n_x, grid_end_x8)),
+                _mm256_abs_epi32(_mm256_sub_epi32(n_y, grid_end_y8))
+                );
+        n_hdist = _mm256_mullo_epi32(n_hdist, _mm256_set1_epi32(1000));
+    
+        __m256i mask = _mm256_set1_epi8(0xFF);
+    
+        // x >= 0  ->  x > -1
+        mask = _mm256_and_si256(mask, _mm256_cmpgt_epi32(n_x, _mm256_set1_epi32(-1)));
+        // x < 256  ->  256 > x
+        mask = _mm256_and_si256(mask, _mm256_cmpgt_epi32(_mm256_set1_epi32(256), n_x));
+        // y >= 0  ->  y > -1
+        mask = _mm256_and_si256(mask, _mm256_cmpgt_epi32(n_y, _mm256_set1_epi32(-1)));
+        // y < 256  ->  256 > y
+        mask = _mm256_and_si256(mask, _mm256_cmpgt_epi32(_mm256_set1_epi32(256), n_y));
+    
+        // Cells not visited by this search count as s32_MAX away.
+        const __m256i search_ids =
+            _mm256_mask_i32gather_epi32(
+                _mm256_set1_epi32(0),
+                (s32*)&path_find->grid_search_id[0],
+                n_idx,
+                mask,
+                4);
+        const __m256i is_visited = _mm256_cmpeq_epi32(search_ids, _mm256_set1_epi32(path_find->search_id));
+        const __m256i existing_dists =
+            _mm256_mask_i32gather_epi32(
+                _mm256_set1_epi32(s32_MAX),
+                (s32*)&path_find->grid_dist[0],
+                n_idx,
+                _mm256_and_si256(mask, is_visited),
+                4);
+        mask = _mm256_and_si256(mask, _mm256_cmpgt_epi32(existing_dists, n_dist));
 
-        u16 i_min = 0;
-        u32 min_val = u32_MAX;
+        // cell = path->grid[n_idx / 8]
+        __m256i cell =
+            _mm256_mask_i32gather_epi32(
+                _mm256_set1_epi32(u32_MAX),
+                (s32*)&wall_grid->grid[0],
+                _mm256_srli_epi32(n_idx, 3),
+                mask,
+                1);
+        // cell_mask = 1 << (n_idx % 8)
+        __m256i cell_mask = _mm256_sllv_epi32(
+            _mm256_set1_epi32(1),
+            _mm256_and_si256(n_idx, _mm256_set1_epi32(7)));
+        // cell = cell & cell_mask
+        cell = _mm256_and_si256(cell, cell_mask);
+        // cell = cell == 0;
+        cell = _mm256_cmpeq_epi32(cell, _mm256_set1_epi32(0));
+        mask = _mm256_and_si256(mask, cell);
 
-        if(num_open_list < 8)
+        u32 scalar_mask[8];
+        _mm256_storeu_si256((__m256i*)scalar_mask, mask);
+        u32 scalar_n_idx[8];
+        _mm256_storeu_si256((__m256i*)scalar_n_idx, n_idx);
+        u32 scalar_n_dist[8];
+        _mm256_storeu_si256((__m256i*)scalar_n_dist, n_dist);
+        u32 scalar_n_hdist[8];
+        _mm256_storeu_si256((__m256i*)scalar_n_hdist, n_hdist);
+        u32 scalar_is_visited[8];
+        _mm256_storeu_si256((__m256i*)scalar_is_visited, is_visited);
+        for(u64 i = 0; i < 8; i++)
         {
-            for(u64 i = 0; i < num_open_list; i++)
+            const s32 dx = (s32)(scalar_n_idx[i] & 0xFF) - (s32)cur_x;
+            const s32 dy = (s32)(scalar_n_idx[i] >> 8) - (s32)cur_y;
+            if(scalar_mask[i] && (!dx || !dy || can_step_diagonally(wall_grid, cur_x, cur_y, dx, dy)))
             {
-                const u32 d = path_find->open_list_f_dist[i];
-                i_min = d < min_val ? (u16)i : i_min;
-                min_val = d < min_val ? d : min_val;
+                path_find_relax(
+                    path_find,
+                    (u16)scalar_n_idx[i],
+                    cur_idx,
+                    scalar_n_dist[i],
+                    scalar_n_dist[i] + scalar_n_hdist[i],
+                    scalar_is_visited[i] != 0);
             }
         }
-        else
+    }
+    #endif
+    
+    #if 0
+    for(u64 i_dir = 0; i_dir < 8; i_dir++)
+    {
+        const s64 dirs[8][2] =
         {
-            __m256i i_min8 = _mm256_set1_epi32(0);
-            // Use s32_MAX because _mm256_min_epi32 is a signed compare.
-            __m256i min_val8 = _mm256_set1_epi32(s32_MAX);
-            for(s32 i = 0; i < (s32)num_open_list - 8; i += 8)
-            {
-                const __m256i i8 = _mm256_setr_epi32(i + 0, i + 1, i + 2, i + 3, i + 4, i + 5, i + 6, i + 7);
-                const __m256i d = _mm256_loadu_si256((__m256i*)(path_find->open_list_f_dist + i));
-                const __m256i mask = _mm256_cmpgt_epi32(min_val8, d);
-                i_min8 =
-                    _mm256_blendv_epi8(
-                        i_min8, // 0
-                        i8, // 1
-                        mask
-                );
-                min_val8 = _mm256_min_epi32(min_val8, d);
-            }
-            {
-                const s32 i = (s32)num_open_list - 8;
-                const __m256i i8 = _mm256_setr_epi32(i + 0, i + 1, i + 2, i + 3, i + 4, i + 5, i + 6, i + 7);
-                const __m256i d = _mm256_loadu_si256((__m256i*)(path_find->open_list_f_dist + i));
-                const __m256i mask = _mm256_cmpgt_epi32(min_val8, d);
-                i_min8 =
-                    _mm256_blendv_epi8(
-                        i_min8, // 0
-                        i8, // 1
-                        mask
-                );
-                min_val8 = _mm256_min_epi32(min_val8, d);
-            }
-            u32 min_val8_array[8];
-            _mm256_storeu_si256((__m256i*)min_val8_array, min_val8);
-            u32 i_min8_array[8];
-            _mm256_storeu_si256((__m256i*)i_min8_array, i_min8);
-            for(u64 i = 0; i < 8; i++)
-            {
-                if(min_val8_array[i] < min_val)
-                {
-                    min_val = min_val8_array[i];
-                    i_min = (u16)i_min8_array[i];
-                }
-            }
+            { -1, -1 },
+            {  0, -1 },
+            {  1, -1 },
+            { -1,  0 },
+            {  1,  0 },
+            { -1,  1 },
+            {  0,  1 },
+            {  1,  1 },
+        };
+        const s64 n_x = (s64)cur_x + dirs[i_dir][0];
+        const s64 n_y = (s64)cur_y + dirs[i_dir][1];
+        const u16 n_idx = (u16)((u64)n_y * 256ULL + (u64)n_x);
+        const u32 dists[8] =
+        {
+            1500,
+            1000,
+            1500,
+            1000,
+            1000,
+            1500,
+            1000,
+            1500,
+        };
+        const u32 n_dist = cur_dist + dists[i_dir];
+        const u32 n_hdist = 
+            (u32)max_s32(
+                abs_s32((s32)n_x - (s32)grid_end_x), 
+                abs_s32((s32)n_y - (s32)grid_end_y)
+            ) * 1000;
+        u32 mask = 1;
+        
+        mask = mask && (n_x >= 0);
+        mask = mask && (n_x < 256);
+        mask = mask && (n_y >= 0);
+        mask = mask && (n_y < 256);
+        mask = mask && is_open_cell(wall_grid, (u8)n_x, (u8)n_y);
+        mask = mask && (!dirs[i_dir][0] || !dirs[i_dir][1] || can_step_diagonally(wall_grid, cur_x, cur_y, (s32)dirs[i_dir][0], (s32)dirs[i_dir][1]));
+        const u8 was_visited = mask && is_visited_cell(path_find, n_idx);
+        mask = mask && (!was_visited || path_find->grid_dist[n_idx] > n_dist);
+        if(mask)
+        {
+            path_find_relax(path_find, n_idx, cur_idx, n_dist, n_dist + n_hdist, was_visited);
         }
-        ASSERT(min_val != u32_MAX, "Bad val");
-        ASSERT(i_min < num_open_list, "Bad val");
-
-        const u16 cur_idx = path_find->open_list[i_min];
-        const u8 cur_x = (u8)((cur_idx >> 0U) & 0xFF);
-        const u8 cur_y = (u8)((cur_idx >> 8U) & 0xFF);
-        const u32 cur_dist = path_find->grid_dist[cur_idx];
+    }
+    #endif
+}
 
-        path_find->open_list[i_min] = path_find->open_list[num_open_list - 1];
-        path_find->open_list_f_dist[i_min] = path_find->open_list_f_dist[num_open_list - 1];
-        num_open_list--;
+// Jump point search.
+// The grid is uniform cost and 8-connected, and like run_path_find diagonal steps may not cut corners, so only
+// straight moves have forced neighbors. Straight scans read 64 cells per step from the bit rows (the transposed grid for vertical scans) and find
+// the first wall, forced neighbor or goal with tzcnt/lzcnt.
 
-        if(cur_x == grid_end_x && cur_y == grid_end_y)
+// Bit i is set if cell 'start + i' of the 256 cell 'row' is a wall. Cells outside the grid, or a NULL row, are walls.
+static inline u64 load_wall_bits(const u8* row, const s32 start)
+{
+    u64 words[2] = { u64_MAX, u64_MAX };
+    const s32 first_word = start >> 6;
+    for(s32 i = 0; i < 2; i++)
+    {
+        const s32 word = first_word + i;
+        if(row && word >= 0 && word < 4)
         {
-            u32 r_num_path = 0;
+            memcpy(&words[i], row + word * 8, sizeof(u64));
+        }
+    }
 
-            u16 rewind_idx = cur_idx;
-            while(rewind_idx != (grid_start_y * 256 + grid_start_x))
-            {
-                ASSERT(r_num_path < MAX_PATH_LEN, "Path find result path overflow.");
+    const s32 shift = start & 63;
+    return shift ? (words[0] >> shift) | (words[1] << (64 - shift)) : words[0];
+}
 
-                const u8 x = (u8)(rewind_idx & 0xFF);
-                const u8 y = (u8)(rewind_idx >> 8);
+static inline const u8* get_wall_row(const u8* grid, const s32 row)
+{
+    return row >= 0 && row < 256 ? grid + row * 32 : NULL;
+}
 
-                r_path_x[r_num_path] = (s32)x - level_hw;
-                r_path_y[r_num_path] = (s32)y - level_hh;
 
-                r_num_path++;
+// Scans 'row' of 'grid' from 'pos' in direction 'dir' (1 or -1). Returns the position of the first jump point, a cell
+// with a forced neighbor or the goal, or -1 if a wall comes first. 'goal_pos' is -1 if the goal is not on this row.
+static s32 jump_straight(const u8* grid, const s32 row, const s32 pos, const s32 dir, const s32 goal_pos)
+{
+    const u8* cur_row = get_wall_row(grid, row);
+    const u8* above_row = get_wall_row(grid, row + 1);
+    const u8* below_row = get_wall_row(grid, row - 1);
 
-                rewind_idx = path_find->grid_prev[rewind_idx];
+    if(dir > 0)
+    {
+        // The row ends in walls, so this always stops.
+        for(s32 start = pos + 1; ; start += 64)
+        {
+            const u64 walls = load_wall_bits(cur_row, start);
+            // Forced: the side cell is open and the one behind it is a wall.
+            const u64 forced =
+                (load_wall_bits(above_row, start - 1) & ~load_wall_bits(above_row, start)) |
+                (load_wall_bits(below_row, start - 1) & ~load_wall_bits(below_row, start));
+            const u64 goal = goal_pos >= start && goal_pos < start + 64 ? 1ULL << (goal_pos - start) : 0;
+            const u64 stop = walls | forced | goal;
+            if(stop)
+            {
+                const s32 i = (s32)_tzcnt_u64(stop);
+                return (walls >> i) & 1 ? -1 : start + i;
             }
-            // Add the start node.
+        }
+    }
+    else
+    {
+        for(s32 end = pos - 1; ; end -= 64)
+        {
+            const s32 start = end - 63;
+            const u64 walls = load_wall_bits(cur_row, start);
+            const u64 forced =
+                (load_wall_bits(above_row, start + 1) & ~load_wall_bits(above_row, start)) |
+                (load_wall_bits(below_row, start + 1) & ~load_wall_bits(below_row, start));
+            const u64 goal = goal_pos >= start && goal_pos <= end ? 1ULL << (goal_pos - start) : 0;
+            const u64 stop = walls | forced | goal;
+            if(stop)
             {
-                ASSERT(r_num_path < MAX_PATH_LEN, "Path find result path overflow.");
+                const s32 i = 63 - (s32)_lzcnt_u64(stop);
+                return (walls >> i) & 1 ? -1 : start + i;
+            }
+        }
+    }
+}
 
-                const u8 x = (u8)(rewind_idx & 0xFF);
-                const u8 y = (u8)(rewind_idx >> 8);
+// Returns 1 and the jump point in r_x/r_y if moving from (x, y) in direction (dx, dy) reaches one.
+static u8 jump(
+    const struct WallGrid* wall_grid,
+    s32* r_x,
+    s32* r_y,
+    u32* r_num_scans,
+    const s32 x,
+    const s32 y,
+    const s32 dx,
+    const s32 dy,
+    const s32 goal_x,
+    const s32 goal_y)
+{
+    if(dy == 0)
+    {
+        (*r_num_scans)++;
+        const s32 jx = jump_straight(wall_grid->grid, y, x, dx, y == goal_y ? goal_x : -1);
+        *r_x = jx;
+        *r_y = y;
+        return jx >= 0;
+    }
+    if(dx == 0)
+    {
+        (*r_num_scans)++;
+        const s32 jy = jump_straight(wall_grid->grid_transposed, x, y, dy, x == goal_x ? goal_y : -1);
+        *r_x = x;
+        *r_y = jy;
+        return jy >= 0;
+    }
 
-                r_path_x[r_num_path] = (s32)x - level_hw;
-                r_path_y[r_num_path] = (s32)y - level_hh;
+    s32 cx = x;
+    s32 cy = y;
+    while(1)
+    {
+        if(!can_step_diagonally(wall_grid, cx, cy, dx, dy))
+        {
+            return 0;
+        }
+        cx += dx;
+        cy += dy;
+        (*r_num_scans)++;
 
-                r_num_path++;
-            }
+        // Diagonal moves have no forced neighbors when they cannot cut corners.
+        const u8 is_jump_point =
+            (cx == goal_x && cy == goal_y) ||
+            jump_straight(wall_grid->grid, cy, cx, dx, cy == goal_y ? goal_x : -1) >= 0 ||
+            jump_straight(wall_grid->grid_transposed, cx, cy, dy, cx == goal_x ? goal_y : -1) >= 0;
+        if(is_jump_point)
+        {
+            *r_x = cx;
+            *r_y = cy;
+            return 1;
+        }
+    }
+}
 
-            for(u64 i = 0; i < r_num_path / 2; i++)
-            {
-                swap_s32(&r_path_x[i], &r_path_x[r_num_path - 1 - i]);
-                swap_s32(&r_path_y[i], &r_path_y[r_num_path - 1 - i]);
-            }
+// Expands one jump point of a jump point search. Returns the number of straight scans and diagonal steps taken.
+static u32 expand_jps(struct PathFind* path_find, const struct WallGrid* wall_grid, const u16 cur_idx)
+{
+    const s32 cur_x = cur_idx & 0xFF;
+    const s32 cur_y = cur_idx >> 8;
+    const u32 cur_dist = path_find->grid_dist[cur_idx];
+    const s32 grid_end_x = path_find->end_idx & 0xFF;
+    const s32 grid_end_y = path_find->end_idx >> 8;
 
-            return r_num_path;
-        }
+    // Prune the neighbors to the natural and forced ones for the direction we came from. The start tries all 8.
+    const u16 prev_idx = path_find->grid_prev[cur_idx];
+    const s32 dx = sign_s32(cur_x - (prev_idx & 0xFF));
+    const s32 dy = sign_s32(cur_y - (prev_idx >> 8));
 
-        #if 1
+    s32 dirs[8][2];
+    u32 num_dirs = 0;
+    if(dx == 0 && dy == 0)
+    {
+        for(s32 y = -1; y <= 1; y++)
         {
-            const __m256i cur_x8 = _mm256_set1_epi32(cur_x);
-            const __m256i cur_y8 = _mm256_set1_epi32(cur_y);
-            const __m256i cur_dist8 = _mm256_set1_epi32(cur_dist);
-        
-            const __m256i n_x = _mm256_add_epi32(cur_x8, _mm256_setr_epi32(-1,  0,  1, -1,  1, -1,  0,  1));
-            const __m256i n_y = _mm256_add_epi32(cur_y8, _mm256_setr_epi32(-1, -1, -1,  0,  0,  1,  1,  1));
-            const __m256i n_idx = _mm256_add_epi32(_mm256_slli_epi32(n_y, 8), n_x);
-            const __m256i n_dist = _mm256_add_epi32(cur_dist8, _mm256_setr_epi32(1500, 1000, 1500, 1000, 1000, 1500, 1000, 1500));
-
-            const __m256i grid_end_x8 = _mm256_set1_epi32(grid_end_x);
-            const __m256i grid_end_y8 = _mm256_set1_epi32(grid_end_y);
-            __m256i n_hdist = 
-                _mm256_max_epi32(
-                    _mm256_abs_epi32(_mm256_sub_epi32(n_x, grid_end_x8)),
-                    _mm256_abs_epi32(_mm256_sub_epi32(n_y, grid_end_y8))
-                    );
-            n_hdist = _mm256_mullo_epi32(n_hdist, _mm256_set1_epi32(1000));
-        
-            __m256i mask = _mm256_set1_epi8(0xFF);
-        
-            // x >= 0  ->  x > -1
-            mask = _mm256_and_si256(mask, _mm256_cmpgt_epi32(n_x, _mm256_set1_epi32(-1)));
-            // x < 256  ->  256 > x
-            mask = _mm256_and_si256(mask, _mm256_cmpgt_epi32(_mm256_set1_epi32(256), n_x));
-            // y >= 0  ->  y > -1
-            mask = _mm256_and_si256(mask, _mm256_cmpgt_epi32(n_y, _mm256_set1_epi32(-1)));
-            // y < 256  ->  256 > y
-            mask = _mm256_and_si256(mask, _mm256_cmpgt_epi32(_mm256_set1_epi32(256), n_y));
-        
-            const __m256i existing_dists =
-                _mm256_mask_i32gather_epi32(
-                    _mm256_set1_epi32(u32_MAX),
-                    (s32*)&path_find->grid_dist[0],
-                    n_idx,
-                    mask,
-                    4);
-            mask = _mm256_and_si256(mask, _mm256_cmpgt_epi32(existing_dists, n_dist));
-
-            // cell = path->grid[n_idx / 8]
-            __m256i cell =
-                _mm256_mask_i32gather_epi32(
-                    _mm256_set1_epi32(u32_MAX),
-                    (s32*)&path_find->grid[0],
-                    _mm256_srli_epi32(n_idx, 3),
-                    mask,
-                    1);
-            // cell_mask = 1 << (n_idx % 8)
-            __m256i cell_mask = _mm256_sllv_epi32(
-                _mm256_set1_epi32(1),
-                _mm256_and_si256(n_idx, _mm256_set1_epi32(7)));
-            // cell = cell & cell_mask
-            cell = _mm256_and_si256(cell, cell_mask);
-            // cell = cell == 0;
-            cell = _mm256_cmpeq_epi32(cell, _mm256_set1_epi32(0));
-            mask = _mm256_and_si256(mask, cell);
-
-            u32 scalar_mask[8];
-            _mm256_storeu_si256((__m256i*)scalar_mask, mask);
-            u32 scalar_n_idx[8];
-            _mm256_storeu_si256((__m256i*)scalar_n_idx, n_idx);
-            u32 scalar_n_dist[8];
-            _mm256_storeu_si256((__m256i*)scalar_n_dist, n_dist);
-            u32 scalar_n_hdist[8];
-            _mm256_storeu_si256((__m256i*)scalar_n_hdist, n_hdist);
-            for(u64 i = 0; i < 8; i++)
+            for(s32 x = -1; x <= 1; x++)
             {
-                const u32 add = scalar_mask[i] != 0;
-                if(add)
+                if(x || y)
                 {
-                    ASSERT(num_open_list < ARRAY_COUNT(path_find->open_list), "Path find open list overflow.");
-                    path_find->grid_dist[scalar_n_idx[i]] = scalar_n_dist[i];
-                    path_find->grid_prev[scalar_n_idx[i]] = cur_idx;
-                    path_find->open_list[num_open_list] = (u16)scalar_n_idx[i];
-                    path_find->open_list_f_dist[num_open_list] = scalar_n_dist[i] + scalar_n_hdist[i];
-                    num_open_list++;
+                    dirs[num_dirs][0] = x;
+                    dirs[num_dirs][1] = y;
+                    num_dirs++;
                 }
             }
         }
-        #endif
-        
-        #if 0
-        for(u64 i_dir = 0; i_dir < 8; i_dir++)
+    }
+    else if(dx && dy)
+    {
+        dirs[num_dirs][0] = dx; dirs[num_dirs][1] = dy; num_dirs++;
+        dirs[num_dirs][0] = dx; dirs[num_dirs][1] = 0;  num_dirs++;
+        dirs[num_dirs][0] = 0;  dirs[num_dirs][1] = dy; num_dirs++;
+    }
+    else if(dx)
+    {
+        // A wall behind a side cell forces the side cell and the diagonal past it.
+        dirs[num_dirs][0] = dx; dirs[num_dirs][1] = 0; num_dirs++;
+        for(s32 side = -1; side <= 1; side += 2)
         {
-            const s64 dirs[8][2] =
+            if(is_wall_cell(wall_grid, cur_x - dx, cur_y + side))
             {
-                { -1, -1 },
-                {  0, -1 },
-                {  1, -1 },
-                { -1,  0 },
-                {  1,  0 },
-                { -1,  1 },
-                {  0,  1 },
-                {  1,  1 },
-            };
-            const s64 n_x = (s64)cur_x + dirs[i_dir][0];
-            const s64 n_y = (s64)cur_y + dirs[i_dir][1];
-            const u16 n_idx = (u16)((u64)n_y * 256ULL + (u64)n_x);
-            const u32 dists[8] =
+                dirs[num_dirs][0] = 0;  dirs[num_dirs][1] = side; num_dirs++;
+                dirs[num_dirs][0] = dx; dirs[num_dirs][1] = side; num_dirs++;
+            }
+        }
+    }
+    else
+    {
+        dirs[num_dirs][0] = 0; dirs[num_dirs][1] = dy; num_dirs++;
+        for(s32 side = -1; side <= 1; side += 2)
+        {
+            if(is_wall_cell(wall_grid, cur_x + side, cur_y - dy))
             {
-                1500,
-                1000,
-                1500,
-                1000,
-                1000,
-                1500,
-                1000,
-                1500,
-            };
-            const u32 n_dist = cur_dist + dists[i_dir];
-            const u32 n_hdist = 
-                (u32)max_s32(
-                    abs_s32((s32)n_x - (s32)grid_end_x), 
-                    abs_s32((s32)n_y - (s32)grid_end_y)
-                ) * 1000;
-            u32 mask = 1;
-            
-            mask = mask && (n_x >= 0);
-            mask = mask && (n_x < 256);
-            mask = mask && (n_y >= 0);
-            mask = mask && (n_y < 256);
-            mask = mask && is_open_cell(path_find, (u8)n_x, (u8)n_y);
-            mask = mask && path_find->grid_dist[n_idx] > n_dist;
-            const u32 add = mask;
-            ASSERT(!add || num_open_list < ARRAY_COUNT(path_find->open_list), "Path find open list overflow.");
-            path_find->grid_dist[n_idx] = add ? n_dist : path_find->grid_dist[n_idx];
-            path_find->grid_prev[n_idx] = add ? cur_idx : path_find->grid_prev[n_idx];
-            path_find->open_list[num_open_list] = n_idx;
-            path_find->open_list_f_dist[num_open_list] = n_dist + n_hdist;
-            num_open_list += add;
-        }
-        #endif
-
-        path_find->num_open_list = num_open_list;
+                dirs[num_dirs][0] = side; dirs[num_dirs][1] = 0;  num_dirs++;
+                dirs[num_dirs][0] = side; dirs[num_dirs][1] = dy; num_dirs++;
+            }
+        }
+    }
+
+    u32 num_scans = 0;
+    for(u32 i_dir = 0; i_dir < num_dirs; i_dir++)
+    {
+        s32 jx, jy;
+        if(!jump(wall_grid, &jx, &jy, &num_scans, cur_x, cur_y, dirs[i_dir][0], dirs[i_dir][1], grid_end_x, grid_end_y))
+        {
+            continue;
+        }
+
+        const u32 num_steps = (u32)max_s32(abs_s32(jx - cur_x), abs_s32(jy - cur_y));
+        const u32 dist = cur_dist + num_steps * (dirs[i_dir][0] && dirs[i_dir][1] ? 1500 : 1000);
+        const u32 hdist = (u32)max_s32(abs_s32(jx - grid_end_x), abs_s32(jy - grid_end_y)) * 1000;
+
+        const u16 j_idx = (u16)(jy * 256 + jx);
+        const u8 was_visited = is_visited_cell(path_find, j_idx);
+        if(!was_visited || path_find->grid_dist[j_idx] > dist)
+        {
+            path_find_relax(path_find, j_idx, cur_idx, dist, dist + hdist, was_visited);
+        }
+    }
+
+    return num_scans;
+}
+
+u8 start_path_find(
+    struct PathFind* path_find,
+    const enum PathFindMode mode,
+    const struct WallGrid* wall_grid,
+    const struct Level* level,
+    const s32 start_x,
+    const s32 start_y,
+    const s32 end_x,
+    const s32 end_y)
+{
+    ASSERT(mode == PATH_FIND_MODE_ASTAR || mode == PATH_FIND_MODE_JPS, "Path find mode %u cannot be resumed.", (u32)mode);
+
+    u8 grid_start_x, grid_start_y, grid_end_x, grid_end_y;
+    if(!begin_path_find(
+        path_find,
+        &grid_start_x,
+        &grid_start_y,
+        &grid_end_x,
+        &grid_end_y,
+        wall_grid,
+        level,
+        start_x,
+        start_y,
+        end_x,
+        end_y))
+    {
+        path_find->num_open_list = 0;
+        return 0;
+    }
+
+    path_find->mode = mode;
+    path_find->end_idx = (u16)(grid_end_y * 256 + grid_end_x);
+    return 1;
+}
+
+enum PathFindStatus resume_path_find(struct PathFind* path_find, const struct WallGrid* wall_grid, u32* r_budget)
+{
+    while(1)
+    {
+        if(path_find->num_open_list == 0)
+        {
+            return PATH_FIND_STATUS_NO_PATH;
+        }
+        if(path_find->open_list[0] == path_find->end_idx)
+        {
+            return PATH_FIND_STATUS_DONE;
+        }
+        if(*r_budget == 0)
+        {
+            return PATH_FIND_STATUS_SEARCHING;
+        }
+
+        const u16 cur_idx = open_list_pop(path_find);
+        if(path_find->mode == PATH_FIND_MODE_JPS)
+        {
+            *r_budget -= min_u32(expand_jps(path_find, wall_grid, cur_idx), *r_budget);
+        }
+        else
+        {
+            expand_astar(path_find, wall_grid, cur_idx);
+            (*r_budget)--;
+        }
+    }
+}
+
+u32 get_path_find_result(const struct PathFind* path_find, s32* r_path_x, s32* r_path_y, const struct Level* level)
+{
+    return write_path(path_find, r_path_x, r_path_y, level, path_find->end_idx);
+}
+
+// Runs a resumable search to the end in one go, adding the work it spent to '*r_work'.
+static u32 run_resumable_path_find(
+    struct PathFind* path_find,
+    const enum PathFindMode mode,
+    u32* r_work,
+    s32* r_path_x,
+    s32* r_path_y,
+    const struct WallGrid* wall_grid,
+    const struct Level* level,
+    const s32 start_x,
+    const s32 start_y,
+    const s32 end_x,
+    const s32 end_y)
+{
+    if(!start_path_find(path_find, mode, wall_grid, level, start_x, start_y, end_x, end_y))
+    {
+        return 0;
     }
+
+    u32 budget = u32_MAX;
+    const enum PathFindStatus status = resume_path_find(path_find, wall_grid, &budget);
+    *r_work += u32_MAX - budget;
+    if(status != PATH_FIND_STATUS_DONE)
+    {
+        return 0;
+    }
+    return get_path_find_result(path_find, r_path_x, r_path_y, level);
+}
+
+u32 run_path_find(
+    struct PathFind* path_find,
+    s32* r_path_x,
+    s32* r_path_y,
+    const struct WallGrid* wall_grid,
+    const struct Level* level,
+    const s32 start_x,
+    const s32 start_y,
+    const s32 end_x,
+    const s32 end_y)
+{
+    u32 work = 0;
+    return run_resumable_path_find(
+        path_find,
+        PATH_FIND_MODE_ASTAR,
+        &work,
+        r_path_x,
+        r_path_y,
+        wall_grid,
+        level,
+        start_x,
+        start_y,
+        end_x,
+        end_y);
+}
+
+u32 run_path_find_jps(
+    struct PathFind* path_find,
+    s32* r_path_x,
+    s32* r_path_y,
+    const struct WallGrid* wall_grid,
+    const struct Level* level,
+    const s32 start_x,
+    const s32 start_y,
+    const s32 end_x,
+    const s32 end_y)
+{
+    u32 work = 0;
+    return run_resumable_path_find(
+        path_find,
+        PATH_FIND_MODE_JPS,
+        &work,
+        r_path_x,
+        r_path_y,
+        wall_grid,
+        level,
+        start_x,
+        start_y,
+        end_x,
+        end_y);
+}
+
+// Hierarchical path finding.
+
+// Refine abstract segments until the path is at least this long or reaches the end.
+#define PATH_FIND_HPA_MIN_REFINED_LEN (PATH_FIND_CLUSTER_SIZE * 2)
+
+// Expands one cell of a Dijkstra search that never leaves the box [x0, x1) x [y0, y1). With a 'target_box', x0, y0,
+// x1, y1 inclusive, the search is an A* towards whichever cell of the box is closest.
+static void expand_dijkstra(
+    struct PathFind* path_find,
+    const struct WallGrid* wall_grid,
+    const u16 cur_idx,
+    const s32 x0,
+    const s32 y0,
+    const s32 x1,
+    const s32 y1,
+    const s32* target_box)
+{
+    const s32 cur_x = cur_idx & 0xFF;
+    const s32 cur_y = cur_idx >> 8;
+    const u32 cur_dist = path_find->grid_dist[cur_idx];
+
+    for(s32 dy = -1; dy <= 1; dy++)
+    {
+        for(s32 dx = -1; dx <= 1; dx++)
+        {
+            const s32 n_x = cur_x + dx;
+            const s32 n_y = cur_y + dy;
+            if((!dx && !dy) || n_x < x0 || n_x >= x1 || n_y < y0 || n_y >= y1 || is_wall_cell(wall_grid, n_x, n_y) ||
+               (dx && dy && !can_step_diagonally(wall_grid, cur_x, cur_y, dx, dy)))
+            {
+                continue;
+            }
+
+            const u32 dist = cur_dist + (dx && dy ? 1500 : 1000);
+            const u16 n_idx = (u16)(n_y * 256 + n_x);
+            const u8 was_visited = is_visited_cell(path_find, n_idx);
+            if(!was_visited || path_find->grid_dist[n_idx] > dist)
+            {
+                // Distance to a box is a consistent heuristic, like the distance to a cell.
+                const u32 hdist = target_box ?
+                    (u32)max_s32(
+                        max_s32(target_box[0] - n_x, n_x - target_box[2]),
+                        max_s32(max_s32(target_box[1] - n_y, n_y - target_box[3]), 0)) * 1000 :
+                    0;
+                path_find_relax(path_find, n_idx, cur_idx, dist, dist + hdist, was_visited);
+            }
+        }
+    }
+}
+
+// Dijkstra from 'start_idx' that never leaves the box [x0, x1) x [y0, y1), stopping once the 'num_nodes' nodes in the
+// box are settled. Afterwards every node reachable within the box has its distance from the start in grid_dist. With
+// no 'clusters' the whole box is searched. Returns the number of cells expanded.
+static u32 search_box(
+    struct PathFind* path_find,
+    const struct PathFindClusters* clusters,
+    const struct WallGrid* wall_grid,
+    const u16 start_idx,
+    const s32 x0,
+    const s32 y0,
+    const s32 x1,
+    const s32 y1,
+    u32 num_nodes)
+{
+    u32 r_num_expanded = 0;
+    start_search(path_find, start_idx);
+    while(path_find->num_open_list && num_nodes)
+    {
+        const u16 cur_idx = open_list_pop(path_find);
+        if(clusters && clusters->grid_node[cur_idx] != PATH_FIND_NO_NODE)
+        {
+            num_nodes--;
+        }
+        expand_dijkstra(path_find, wall_grid, cur_idx, x0, y0, x1, y1, NULL);
+        r_num_expanded++;
+    }
+    return r_num_expanded;
+}
+
+static inline u32 get_cluster(const struct PathFindClusters* clusters, const s32 x, const s32 y)
+{
+    return (u32)(y / PATH_FIND_CLUSTER_SIZE) * clusters->num_clusters_x + (u32)(x / PATH_FIND_CLUSTER_SIZE);
+}
+
+// Marks entrances on the border between the cells at 'pos - step' and 'pos' for 'len' cells along 'along'. Each open
+// stretch gets one entrance in its middle, or one at each end if it is long.
+static void mark_cluster_entrances(
+    struct PathFindClusters* clusters,
+    const struct WallGrid* wall_grid,
+    const s32 x,
+    const s32 y,
+    const s32 step_x,
+    const s32 step_y,
+    const s32 along_x,
+    const s32 along_y,
+    const s32 len)
+{
+    s32 run_start = -1;
+    for(s32 i = 0; i <= len; i++)
+    {
+        const s32 cx = x + along_x * i;
+        const s32 cy = y + along_y * i;
+        const u8 is_open =
+            i < len &&
+            !is_wall_cell(wall_grid, cx, cy) &&
+            !is_wall_cell(wall_grid, cx - step_x, cy - step_y);
+
+        if(is_open && run_start < 0)
+        {
+            run_start = i;
+        }
+        else if(!is_open && run_start >= 0)
+        {
+            const s32 run_len = i - run_start;
+            const s32 entrances[2] = { run_len < 6 ? run_start + run_len / 2 : run_start, i - 1 };
+            for(s32 j = 0; j < (run_len < 6 ? 1 : 2); j++)
+            {
+                const s32 ex = x + along_x * entrances[j];
+                const s32 ey = y + along_y * entrances[j];
+                clusters->grid_node[ey * 256 + ex] = 0;
+                clusters->grid_node[(ey - step_y) * 256 + (ex - step_x)] = 0;
+            }
+            run_start = -1;
+        }
+    }
+}
+
+// Builds the abstract graph. The in-cluster edges of clusters that do not touch the box [x0, x1) x [y0, y1) of grid
+// cells are copied from 'old_clusters' instead of searched again, if given. Their nodes are the same, numbered from a
+// different first node.
+static void build_path_find_clusters(
+    struct PathFindClusters* clusters,
+    struct PathFind* path_find,
+    const struct PathFindClusters* old_clusters,
+    const s32 dirty_x0,
+    const s32 dirty_y0,
+    const s32 dirty_x1,
+    const s32 dirty_y1,
+    const struct WallGrid* wall_grid,
+    const struct Level* level)
+{
+    const s32 size = PATH_FIND_CLUSTER_SIZE;
+    const s32 level_w = (s32)level->width;
+    const s32 level_h = (s32)level->height;
+    ASSERT(level_w <= 256 && level_h <= 256, "Level does not fit the path find grid.");
+
+    clusters->num_clusters_x = (u32)((level_w + size - 1) / size);
+    clusters->num_clusters_y = (u32)((level_h + size - 1) / size);
+
+    // Mark entrance cells with 0, they are numbered below.
+    FILL_ARRAY(clusters->grid_node, PATH_FIND_NO_NODE);
+    for(s32 y = 0; y < level_h; y += size)
+    {
+        for(s32 x = size; x < level_w; x += size)
+        {
+            mark_cluster_entrances(clusters, wall_grid, x, y, 1, 0, 0, 1, min_s32(size, level_h - y));
+        }
+    }
+    for(s32 y = size; y < level_h; y += size)
+    {
+        for(s32 x = 0; x < level_w; x += size)
+        {
+            mark_cluster_entrances(clusters, wall_grid, x, y, 0, 1, 1, 0, min_s32(size, level_w - x));
+        }
+    }
+
+    // Number the nodes cluster by cluster.
+    clusters->num_nodes = 0;
+    for(u32 cluster_y = 0; cluster_y < clusters->num_clusters_y; cluster_y++)
+    {
+        for(u32 cluster_x = 0; cluster_x < clusters->num_clusters_x; cluster_x++)
+        {
+            const u32 cluster = cluster_y * clusters->num_clusters_x + cluster_x;
+            clusters->cluster_first_node[cluster] = (u16)clusters->num_nodes;
+
+            const s32 x0 = (s32)cluster_x * size;
+            const s32 y0 = (s32)cluster_y * size;
+            for(s32 y = y0; y < min_s32(y0 + size, level_h); y++)
+            {
+                for(s32 x = x0; x < min_s32(x0 + size, level_w); x++)
+                {
+                    if(clusters->grid_node[y * 256 + x] != PATH_FIND_NO_NODE)
+                    {
+                        ASSERT(clusters->num_nodes < MAX_PATH_FIND_NODES, "Path find node overflow.");
+                        clusters->grid_node[y * 256 + x] = (u16)clusters->num_nodes;
+                        clusters->node_cell[clusters->num_nodes] = (u16)(y * 256 + x);
+                        clusters->num_nodes++;
+                    }
+                }
+            }
+            ASSERT(clusters->num_nodes - clusters->cluster_first_node[cluster] <= MAX_PATH_FIND_CLUSTER_NODES,
+                   "Too many nodes in cluster %u.", cluster);
+        }
+    }
+    clusters->cluster_first_node[clusters->num_clusters_x * clusters->num_clusters_y] = (u16)clusters->num_nodes;
+
+    // Edges. Nodes next to each other across a border are one step apart, nodes in the same cluster are linked by
+    // their distance within the cluster.
+    clusters->num_edges = 0;
+    for(u32 node = 0; node < clusters->num_nodes; node++)
+    {
+        clusters->node_first_edge[node] = clusters->num_edges;
+
+        const u16 cell_idx = clusters->node_cell[node];
+        const s32 x = cell_idx & 0xFF;
+        const s32 y = cell_idx >> 8;
+        const u32 cluster = get_cluster(clusters, x, y);
+
+        const s32 dirs[4][2] = { { -1, 0 }, { 1, 0 }, { 0, -1 }, { 0, 1 } };
+        for(u32 i_dir = 0; i_dir < 4; i_dir++)
+        {
+            const s32 n_x = x + dirs[i_dir][0];
+            const s32 n_y = y + dirs[i_dir][1];
+            if(n_x < 0 || n_x >= level_w || n_y < 0 || n_y >= level_h)
+            {
+                continue;
+            }
+            const u16 n_node = clusters->grid_node[n_y * 256 + n_x];
+            if(n_node != PATH_FIND_NO_NODE && get_cluster(clusters, n_x, n_y) != cluster)
+            {
+                ASSERT(clusters->num_edges < MAX_PATH_FIND_EDGES, "Path find edge overflow.");
+                clusters->edge_node[clusters->num_edges] = n_node;
+                clusters->edge_dist[clusters->num_edges] = 1000;
+                clusters->num_edges++;
+            }
+        }
+
+        const s32 x0 = (x / size) * size;
+        const s32 y0 = (y / size) * size;
+        const u32 first_node = clusters->cluster_first_node[cluster];
+        const u32 end_node = clusters->cluster_first_node[cluster + 1];
+        if(old_clusters && (x0 + size <= dirty_x0 || x0 >= dirty_x1 || y0 + size <= dirty_y0 || y0 >= dirty_y1))
+        {
+            const u32 old_first_node = old_clusters->cluster_first_node[cluster];
+            const u32 old_end_node = old_clusters->cluster_first_node[cluster + 1];
+            ASSERT(old_end_node - old_first_node == end_node - first_node, "Clean cluster %u changed nodes.", cluster);
+
+            const u32 old_node = old_first_node + (node - first_node);
+            for(u32 edge = old_clusters->node_first_edge[old_node]; edge < old_clusters->node_first_edge[old_node + 1]; edge++)
+            {
+                const u32 other = old_clusters->edge_node[edge];
+                if(other >= old_first_node && other < old_end_node)
+                {
+                    ASSERT(clusters->num_edges < MAX_PATH_FIND_EDGES, "Path find edge overflow.");
+                    clusters->edge_node[clusters->num_edges] = (u16)(first_node + (other - old_first_node));
+                    clusters->edge_dist[clusters->num_edges] = old_clusters->edge_dist[edge];
+                    clusters->num_edges++;
+                }
+            }
+            continue;
+        }
+
+        search_box(
+            path_find,
+            clusters,
+            wall_grid,
+            cell_idx,
+            x0,
+            y0,
+            min_s32(x0 + size, level_w),
+            min_s32(y0 + size, level_h),
+            end_node - first_node);
+        for(u32 other = first_node; other < end_node; other++)
+        {
+            const u16 other_cell_idx = clusters->node_cell[other];
+            if(other != node && is_visited_cell(path_find, other_cell_idx))
+            {
+                ASSERT(clusters->num_edges < MAX_PATH_FIND_EDGES, "Path find edge overflow.");
+                clusters->edge_node[clusters->num_edges] = (u16)other;
+                clusters->edge_dist[clusters->num_edges] = path_find->grid_dist[other_cell_idx];
+                clusters->num_edges++;
+            }
+        }
+    }
+    clusters->node_first_edge[clusters->num_nodes] = clusters->num_edges;
+}
+
+void init_path_find_clusters(
+    struct PathFindClusters* clusters,
+    struct PathFind* path_find,
+    const struct WallGrid* wall_grid,
+    const struct Level* level)
+{
+    build_path_find_clusters(clusters, path_find, NULL, 0, 0, 0, 0, wall_grid, level);
+}
+
+void update_path_find_clusters(
+    struct PathFindClusters* clusters,
+    struct PathFindClusters* scratch,
+    struct PathFind* path_find,
+    const s32 x,
+    const s32 y,
+    const u32 w,
+    const u32 h,
+    const struct WallGrid* wall_grid,
+    const struct Level* level)
+{
+    // Only what the copied edges are read from.
+    const u32 num_clusters = clusters->num_clusters_x * clusters->num_clusters_y;
+    scratch->num_clusters_x = clusters->num_clusters_x;
+    scratch->num_clusters_y = clusters->num_clusters_y;
+    scratch->num_nodes = clusters->num_nodes;
+    scratch->num_edges = clusters->num_edges;
+    COPY(scratch->cluster_first_node, clusters->cluster_first_node, num_clusters + 1);
+    COPY(scratch->node_first_edge, clusters->node_first_edge, clusters->num_nodes + 1);
+    COPY(scratch->edge_node, clusters->edge_node, clusters->num_edges);
+    COPY(scratch->edge_dist, clusters->edge_dist, clusters->num_edges);
+
+    // Entrances on a cluster's border depend on the cells just outside it.
+    const s32 grid_x = x - wall_grid->origin_x;
+    const s32 grid_y = y - wall_grid->origin_y;
+    build_path_find_clusters(
+        clusters,
+        path_find,
+        scratch,
+        grid_x - 1,
+        grid_y - 1,
+        grid_x + (s32)w + 1,
+        grid_y + (s32)h + 1,
+        wall_grid,
+        level);
+}
+
+// Distances from 'cell_idx' to every node of its cluster, u32_MAX if unreachable within the cluster. Adds the cells
+// expanded to '*r_work'.
+static void get_cluster_node_dists(
+    u32 r_dists[MAX_PATH_FIND_CLUSTER_NODES],
+    u32* r_work,
+    struct PathFind* path_find,
+    const struct PathFindClusters* clusters,
+    const struct WallGrid* wall_grid,
+    const struct Level* level,
+    const u16 cell_idx)
+{
+    const s32 size = PATH_FIND_CLUSTER_SIZE;
+    const s32 x = cell_idx & 0xFF;
+    const s32 y = cell_idx >> 8;
+    const s32 x0 = (x / size) * size;
+    const s32 y0 = (y / size) * size;
+    const u32 cluster = get_cluster(clusters, x, y);
+    const u32 first_node = clusters->cluster_first_node[cluster];
+    const u32 end_node = clusters->cluster_first_node[cluster + 1];
+    *r_work += search_box(
+        path_find,
+        clusters,
+        wall_grid,
+        cell_idx,
+        x0,
+        y0,
+        min_s32(x0 + size, (s32)level->width),
+        min_s32(y0 + size, (s32)level->height),
+        end_node - first_node);
+
+    for(u32 node = first_node; node < end_node; node++)
+    {
+        const u16 node_cell_idx = clusters->node_cell[node];
+        r_dists[node - first_node] = is_visited_cell(path_find, node_cell_idx) ? path_find->grid_dist[node_cell_idx] : u32_MAX;
+    }
+}
+
+static void relax_abstract(
+    struct PathFind* path_find,
+    const u16 cell_idx,
+    const u16 prev_idx,
+    const u32 dist,
+    const u16 end_idx)
+{
+    const s32 dx = abs_s32((cell_idx & 0xFF) - (end_idx & 0xFF));
+    const s32 dy = abs_s32((cell_idx >> 8) - (end_idx >> 8));
+    const u32 hdist = (u32)max_s32(dx, dy) * 1000;
+
+    const u8 was_visited = is_visited_cell(path_find, cell_idx);
+    if(!was_visited || path_find->grid_dist[cell_idx] > dist)
+    {
+        path_find_relax(path_find, cell_idx, prev_idx, dist, dist + hdist, was_visited);
+    }
+}
+
+u32 run_path_find_hpa(
+    struct PathFind* path_find,
+    u32* r_work,
+    s32* r_path_x,
+    s32* r_path_y,
+    const struct PathFindClusters* clusters,
+    const struct WallGrid* wall_grid,
+    const struct Level* level,
+    const s32 start_x,
+    const s32 start_y,
+    const s32 end_x,
+    const s32 end_y)
+{
+    u8 grid_start_x, grid_start_y, grid_end_x, grid_end_y;
+    if(!begin_path_find(
+        path_find,
+        &grid_start_x,
+        &grid_start_y,
+        &grid_end_x,
+        &grid_end_y,
+        wall_grid,
+        level,
+        start_x,
+        start_y,
+        end_x,
+        end_y))
+    {
+        return 0;
+    }
+
+    const u32 start_cluster = get_cluster(clusters, grid_start_x, grid_start_y);
+    const u32 end_cluster = get_cluster(clusters, grid_end_x, grid_end_y);
+    if(start_cluster == end_cluster)
+    {
+        return run_resumable_path_find(
+            path_find,
+            PATH_FIND_MODE_JPS,
+            r_work,
+            r_path_x,
+            r_path_y,
+            wall_grid,
+            level,
+            start_x,
+            start_y,
+            end_x,
+            end_y);
+    }
+
+    const u16 start_idx = (u16)(grid_start_y * 256 + grid_start_x);
+    const u16 end_idx = (u16)(grid_end_y * 256 + grid_end_x);
+
+    // Link the start and end into the graph. Moves are symmetric, so the distances from the end are also the
+    // distances to it.
+    u32 start_node_dists[MAX_PATH_FIND_CLUSTER_NODES];
+    u32 end_node_dists[MAX_PATH_FIND_CLUSTER_NODES];
+    get_cluster_node_dists(start_node_dists, r_work, path_find, clusters, wall_grid, level, start_idx);
+    get_cluster_node_dists(end_node_dists, r_work, path_find, clusters, wall_grid, level, end_idx);
+    const u32 start_first_node = clusters->cluster_first_node[start_cluster];
+    const u32 start_num_nodes = clusters->cluster_first_node[start_cluster + 1] - start_first_node;
+    const u32 end_first_node = clusters->cluster_first_node[end_cluster];
+    const u32 end_num_nodes = clusters->cluster_first_node[end_cluster + 1] - end_first_node;
+
+    // A* over the nodes, using the grid cells of the nodes as search cells.
+    start_search(path_find, start_idx);
+    u8 found = 0;
+    while(path_find->num_open_list)
+    {
+        const u16 cur_idx = open_list_pop(path_find);
+        const u32 cur_dist = path_find->grid_dist[cur_idx];
+        if(cur_idx == end_idx)
+        {
+            found = 1;
+            break;
+        }
+        (*r_work)++;
+
+        if(cur_idx == start_idx)
+        {
+            for(u32 i = 0; i < start_num_nodes; i++)
+            {
+                if(start_node_dists[i] != u32_MAX)
+                {
+                    relax_abstract(path_find, clusters->node_cell[start_first_node + i], cur_idx, cur_dist + start_node_dists[i], end_idx);
+                }
+            }
+        }
+
+        const u16 node = clusters->grid_node[cur_idx];
+        if(node != PATH_FIND_NO_NODE)
+        {
+            for(u32 edge = clusters->node_first_edge[node]; edge < clusters->node_first_edge[node + 1]; edge++)
+            {
+                const u16 n_cell_idx = clusters->node_cell[clusters->edge_node[edge]];
+                relax_abstract(path_find, n_cell_idx, cur_idx, cur_dist + clusters->edge_dist[edge], end_idx);
+            }
+
+            if(node >= end_first_node && node < end_first_node + end_num_nodes && end_node_dists[node - end_first_node] != u32_MAX)
+            {
+                relax_abstract(path_find, end_idx, cur_idx, cur_dist + end_node_dists[node - end_first_node], end_idx);
+            }
+        }
+    }
+    if(!found)
+    {
+        return 0;
+    }
+
+    // The refining searches below reuse the scratch, so take the waypoints out first.
+    u16 waypoints[MAX_PATH_FIND_NODES + 2];
+    u32 num_waypoints = 0;
+    for(u16 idx = end_idx; ; idx = path_find->grid_prev[idx])
+    {
+        ASSERT(num_waypoints < ARRAY_COUNT(waypoints), "Path find waypoint overflow.");
+        waypoints[num_waypoints++] = idx;
+        if(idx == start_idx)
+        {
+            break;
+        }
+    }
+
+    // Refine the first few segments. Each segment's path starts on the last cell of the one before.
+    const s32 level_hw = level->width / 2;
+    const s32 level_hh = level->height / 2;
+    u32 r_num_path = 0;
+    for(u32 i = num_waypoints - 1; i > 0; i--)
+    {
+        // A segment stays within two clusters.
+        if(r_num_path + 2 * PATH_FIND_CLUSTER_SIZE * PATH_FIND_CLUSTER_SIZE > MAX_PATH_LEN)
+        {
+            break;
+        }
+
+        const u16 a = waypoints[i];
+        const u16 b = waypoints[i - 1];
+        const u32 base = r_num_path ? r_num_path - 1 : 0;
+        const u32 num_segment = run_resumable_path_find(
+            path_find,
+            PATH_FIND_MODE_JPS,
+            r_work,
+            r_path_x + base,
+            r_path_y + base,
+            wall_grid,
+            level,
+            (a & 0xFF) - level_hw,
+            (a >> 8) - level_hh,
+            (b & 0xFF) - level_hw,
+            (b >> 8) - level_hh);
+        ASSERT(num_segment, "Could not refine abstract path segment.");
+        r_num_path = base + num_segment;
+
+        if(r_num_path >= PATH_FIND_HPA_MIN_REFINED_LEN)
+        {
+            break;
+        }
+    }
+
+    return r_num_path;
+}
+
+// Flow fields.
+
+void start_flow_field_build(struct PathFind* path_find, const struct Level* level, const u16 goal_idx)
+{
+    ASSERT(level->width <= 256 && level->height <= 256, "Level does not fit the path find grid.");
+    ASSERT((goal_idx & 0xFF) < level->width && (goal_idx >> 8) < level->height, "Flow field goal is outside the level.");
+
+    // Moves are symmetric, so the prev links of a search out of the goal lead back to it along shortest paths.
+    start_search(path_find, goal_idx);
+    path_find->end_idx = goal_idx;
+}
+
+u8 path_find_reached_box(const struct PathFind* path_find, const s32 x0, const s32 y0, const s32 x1, const s32 y1)
+{
+    for(s32 y = max_s32(y0 - 1, 0); y < min_s32(y1 + 1, 256); y++)
+    {
+        for(s32 x = max_s32(x0 - 1, 0); x < min_s32(x1 + 1, 256); x++)
+        {
+            if(is_visited_cell(path_find, (u16)(y * 256 + x)))
+            {
+                return 1;
+            }
+        }
+    }
+    return 0;
+}
+
+enum PathFindStatus resume_flow_field_build(
+    struct FlowField* flow_field,
+    struct PathFind* path_find,
+    const struct WallGrid* wall_grid,
+    const struct Level* level,
+    u32* r_budget)
+{
+    const s32 level_w = (s32)level->width;
+    const s32 level_h = (s32)level->height;
+    while(path_find->num_open_list)
+    {
+        if(*r_budget == 0)
+        {
+            return PATH_FIND_STATUS_SEARCHING;
+        }
+        const u16 cur_idx = open_list_pop(path_find);
+        expand_dijkstra(path_find, wall_grid, cur_idx, 0, 0, level_w, level_h, NULL);
+        (*r_budget)--;
+    }
+
+    flow_field->goal_idx = path_find->end_idx;
+    for(s32 y = 0; y < level_h; y++)
+    {
+        for(s32 x = 0; x < level_w; x++)
+        {
+            const u16 cell_idx = (u16)(y * 256 + x);
+            flow_field->grid_next[cell_idx] = is_visited_cell(path_find, cell_idx) ? path_find->grid_prev[cell_idx] : cell_idx;
+        }
+    }
+    return PATH_FIND_STATUS_DONE;
+}
+
+u32 follow_flow_field(
+    const struct FlowField* flow_field,
+    s32* r_path_x,
+    s32* r_path_y,
+    const u32 max_path_len,
+    const struct WallGrid* wall_grid,
+    const struct Level* level,
+    const s32 start_x,
+    const s32 start_y)
+{
+    const s32 level_hw = level->width / 2;
+    const s32 level_hh = level->height / 2;
+
+    u16 cell_idx = find_start_cell(wall_grid, level, start_x, start_y);
+    if(cell_idx != flow_field->goal_idx && flow_field->grid_next[cell_idx] == cell_idx)
+    {
+        // Cannot reach the goal.
+        return 0;
+    }
+
+    u32 r_num_path = 0;
+    while(r_num_path < max_path_len)
+    {
+        r_path_x[r_num_path] = (cell_idx & 0xFF) - level_hw;
+        r_path_y[r_num_path] = (cell_idx >> 8) - level_hh;
+        r_num_path++;
+        if(cell_idx == flow_field->goal_idx)
+        {
+            break;
+        }
+        cell_idx = flow_field->grid_next[cell_idx];
+    }
+    return r_num_path;
+}
+
+// Batched path finding.
+
+// Writes the first 'max_path_len' cells of the path from 'from_idx' back to the start of the search, in level space.
+// For searches run out of the end, where the grid_prev chain already leads forwards. Links may span a line of cells
+// as in write_path.
+static u32 write_reverse_path(
+    const struct PathFind* path_find,
+    s32* r_path_x,
+    s32* r_path_y,
+    const u32 max_path_len,
+    const struct Level* level,
+    const u16 from_idx)
+{
+    const s32 level_hw = level->width / 2;
+    const s32 level_hh = level->height / 2;
+
+    u32 r_num_path = 0;
+    s32 x = from_idx & 0xFF;
+    s32 y = from_idx >> 8;
+    u16 link_idx = from_idx;
+    while(r_num_path < max_path_len)
+    {
+        r_path_x[r_num_path] = x - level_hw;
+        r_path_y[r_num_path] = y - level_hh;
+        r_num_path++;
+
+        if(x == (link_idx & 0xFF) && y == (link_idx >> 8))
+        {
+            // The start of the search is its own prev.
+            const u16 next_idx = path_find->grid_prev[link_idx];
+            if(next_idx == link_idx)
+            {
+                break;
+            }
+            link_idx = next_idx;
+        }
+
+        const s32 link_x = link_idx & 0xFF;
+        const s32 link_y = link_idx >> 8;
+        ASSERT(link_x == x || link_y == y || abs_s32(link_x - x) == abs_s32(link_y - y), "Path link is not a line.");
+        x += sign_s32(link_x - x);
+        y += sign_s32(link_y - y);
+    }
+    return r_num_path;
+}
+
+// Below this many starts towards one end, separate jump point searches are cheaper than one shared search: on the
+// 128x64 level a shared search costs about as much as 100 JPS searches, but only 2 A* searches.
+#define PATH_FIND_BATCH_MIN_SHARED_JPS 128
+
+// Opens the search out of the end of the requests order[first, last), steered by the distance to the box around their
+// starts.
+static void start_search_to_starts(struct PathFindBatch* batch, struct PathFind* path_find)
+{
+    s32* target_box = batch->target_box;
+    target_box[0] = 255;
+    target_box[1] = 255;
+    target_box[2] = 0;
+    target_box[3] = 0;
+    for(u32 i_order = batch->first; i_order < batch->last; i_order++)
+    {
+        const s32 x = batch->start_idx[batch->order[i_order]] & 0xFF;
+        const s32 y = batch->start_idx[batch->order[i_order]] >> 8;
+        target_box[0] = min_s32(target_box[0], x);
+        target_box[1] = min_s32(target_box[1], y);
+        target_box[2] = max_s32(target_box[2], x);
+        target_box[3] = max_s32(target_box[3], y);
+    }
+    batch->num_settled = batch->first;
+    start_search(path_find, batch->end_idx[batch->order[batch->first]]);
+}
+
+// Expands cells of the shared search, one budget each, until all starts of order[first, last) are settled.
+static enum PathFindStatus resume_search_to_starts(
+    struct PathFindBatch* batch,
+    struct PathFind* path_find,
+    const struct WallGrid* wall_grid,
+    const struct Level* level,
+    u32* r_budget)
+{
+    // Popping a cell settles it. The starts are checked off in order, so each is looked at about once.
+    while(path_find->num_open_list)
+    {
+        while(batch->num_settled < batch->last)
+        {
+            const u16 idx = batch->start_idx[batch->order[batch->num_settled]];
+            if(!is_visited_cell(path_find, idx) || path_find->grid_open_idx[idx] != PATH_FIND_NOT_OPEN)
+            {
+                break;
+            }
+            batch->num_settled++;
+        }
+        if(batch->num_settled == batch->last)
+        {
+            break;
+        }
+        if(*r_budget == 0)
+        {
+            return PATH_FIND_STATUS_SEARCHING;
+        }
+
+        const u16 cur_idx = open_list_pop(path_find);
+        expand_dijkstra(path_find, wall_grid, cur_idx, 0, 0, (s32)level->width, (s32)level->height, batch->target_box);
+        (*r_budget)--;
+    }
+    return PATH_FIND_STATUS_DONE;
+}
+
+// Writes the path of the request order[next] from the finished search, if it reached the start.
+static void write_batch_path(
+    const struct PathFindBatch* batch,
+    const struct PathFind* path_find,
+    s32* r_path_x,
+    s32* r_path_y,
+    u32* r_path_len,
+    const u32 max_path_len,
+    const struct Level* level)
+{
+    const u32 i = batch->order[batch->next];
+    if(is_visited_cell(path_find, batch->start_idx[i]))
+    {
+        r_path_len[i] = write_reverse_path(
+            path_find, r_path_x + i * max_path_len, r_path_y + i * max_path_len, max_path_len, level, batch->start_idx[i]);
+    }
+}
+
+void start_path_find_batch(
+    struct PathFindBatch* batch,
+    u32* r_path_len,
+    const enum PathFindMode mode,
+    const struct PathFindRequest* requests,
+    const u32 num_requests,
+    const struct WallGrid* wall_grid,
+    const struct Level* level)
+{
+    ASSERT(num_requests <= MAX_PATH_FIND_BATCH, "Path find batch of %u is too large.", num_requests);
+    ASSERT(mode == PATH_FIND_MODE_ASTAR || mode == PATH_FIND_MODE_JPS, "Path find mode %u cannot be batched.", (u32)mode);
+    ASSERT(level->width <= 256 && level->height <= 256, "Level does not fit the path find grid.");
+
+    // Sorted by end cell, then start cell, so that requests sharing an end are next to each other and identical
+    // requests are searched once.
+    batch->mode = mode;
+    batch->num_requests = num_requests;
+    batch->num_order = 0;
+    for(u32 i = 0; i < num_requests; i++)
+    {
+        const struct PathFindRequest* request = &requests[i];
+        r_path_len[i] = 0;
+        batch->start_idx[i] = find_start_cell(wall_grid, level, request->start_x, request->start_y);
+        if(!get_path_find_end_cell(&batch->end_idx[i], wall_grid, level, request->end_x, request->end_y))
+        {
+            continue;
+        }
+
+        const u32 key = (u32)batch->end_idx[i] << 16 | batch->start_idx[i];
+        u32 j = batch->num_order++;
+        while(j > 0 && batch->order_key[j - 1] > key)
+        {
+            batch->order[j] = batch->order[j - 1];
+            batch->order_key[j] = batch->order_key[j - 1];
+            j--;
+        }
+        batch->order[j] = (u16)i;
+        batch->order_key[j] = key;
+    }
+
+    batch->first = 0;
+    batch->last = 0;
+    batch->next = 0;
+    batch->is_searching = 0;
+}
+
+enum PathFindStatus resume_path_find_batch(
+    struct PathFindBatch* batch,
+    struct PathFind* path_find,
+    s32* r_path_x,
+    s32* r_path_y,
+    u32* r_path_len,
+    const u32 max_path_len,
+    const struct WallGrid* wall_grid,
+    const struct Level* level,
+    u32* r_budget)
+{
+    // Moves are symmetric, so every search runs out of the end, and the grid_prev links from a start lead forwards
+    // along its path as in a flow field.
+    while(1)
+    {
+        if(batch->is_searching)
+        {
+            if(batch->is_shared)
+            {
+                if(resume_search_to_starts(batch, path_find, wall_grid, level, r_budget) == PATH_FIND_STATUS_SEARCHING)
+                {
+                    return PATH_FIND_STATUS_SEARCHING;
+                }
+            }
+            else
+            {
+                const enum PathFindStatus status = resume_path_find(path_find, wall_grid, r_budget);
+                if(status == PATH_FIND_STATUS_SEARCHING)
+                {
+                    return PATH_FIND_STATUS_SEARCHING;
+                }
+                batch->is_searching = 0;
+                if(status == PATH_FIND_STATUS_DONE)
+                {
+                    write_batch_path(batch, path_find, r_path_x, r_path_y, r_path_len, max_path_len, level);
+                }
+                batch->next++;
+                continue;
+            }
+            batch->is_searching = 0;
+        }
+
+        if(batch->next == batch->last)
+        {
+            // Start on the requests for the next end.
+            if(batch->last == batch->num_order)
+            {
+                return PATH_FIND_STATUS_DONE;
+            }
+            const u16 goal_idx = batch->end_idx[batch->order[batch->last]];
+            batch->first = batch->last;
+            batch->next = batch->first;
+            batch->last = batch->first + 1;
+            while(batch->last < batch->num_order && batch->end_idx[batch->order[batch->last]] == goal_idx)
+            {
+                batch->last++;
+            }
+
+            const u32 num_same_end = batch->last - batch->first;
+            batch->is_shared =
+                batch->mode == PATH_FIND_MODE_JPS ? num_same_end >= PATH_FIND_BATCH_MIN_SHARED_JPS : num_same_end >= 2;
+            if(batch->is_shared)
+            {
+                start_search_to_starts(batch, path_find);
+                batch->is_searching = 1;
+                continue;
+            }
+        }
+
+        const u32 i_order = batch->next;
+        const u32 i = batch->order[i_order];
+        if(i_order > batch->first && batch->order_key[i_order] == batch->order_key[i_order - 1])
+        {
+            const u32 i_same = batch->order[i_order - 1];
+            r_path_len[i] = r_path_len[i_same];
+            COPY(r_path_x + i * max_path_len, r_path_x + i_same * max_path_len, r_path_len[i]);
+            COPY(r_path_y + i * max_path_len, r_path_y + i_same * max_path_len, r_path_len[i]);
+            batch->next++;
+            continue;
+        }
+
+        if(!batch->is_shared)
+        {
+            start_search(path_find, batch->end_idx[i]);
+            path_find->mode = batch->mode;
+            path_find->end_idx = batch->start_idx[i];
+            batch->is_searching = 1;
+            continue;
+        }
+
+        write_batch_path(batch, path_find, r_path_x, r_path_y, r_path_len, max_path_len, level);
+        batch->next++;
+    }
+}
+
+u32 run_path_find_batch(
+    struct PathFind* path_find,
+    s32* r_path_x,
+    s32* r_path_y,
+    u32* r_path_len,
+    const u32 max_path_len,
+    const enum PathFindMode mode,
+    const struct PathFindRequest* requests,
+    const u32 num_requests,
+    const struct WallGrid* wall_grid,
+    const struct Level* level)
+{
+    struct PathFindBatch batch;
+    start_path_find_batch(&batch, r_path_len, mode, requests, num_requests, wall_grid, level);
+    u32 budget = u32_MAX;
+    resume_path_find_batch(&batch, path_find, r_path_x, r_path_y, r_path_len, max_path_len, wall_grid, level, &budget);
+    return u32_MAX - budget;
 }
@@ -2,32 +2,285 @@
 #pragma once
 
 #include "common.h"
+#include "wall_grid.h"
 
 #define MAX_PATH_LEN 4096
 
+#define PATH_FIND_NOT_OPEN u32_MAX
+
+enum PathFindMode
+{
+    PATH_FIND_MODE_ASTAR,
+    PATH_FIND_MODE_JPS,
+    PATH_FIND_MODE_HPA,
+};
+
+enum PathFindStatus
+{
+    PATH_FIND_STATUS_SEARCHING,
+    PATH_FIND_STATUS_DONE,
+    PATH_FIND_STATUS_NO_PATH,
+};
+
+// Abstract graph for hierarchical path finding (HPA*). The level is cut into square clusters. Every open stretch of
+// a border between two clusters gets an entrance, a node on each side, and every pair of nodes in a cluster is
+// linked by their shortest distance inside that cluster. Built once from the walls and shared by all threads.
+#define PATH_FIND_CLUSTER_SIZE 16
+#define MAX_PATH_FIND_CLUSTERS ((256 / PATH_FIND_CLUSTER_SIZE) * (256 / PATH_FIND_CLUSTER_SIZE))
+#define MAX_PATH_FIND_CLUSTER_NODES 64
+#define MAX_PATH_FIND_NODES 4096
+#define MAX_PATH_FIND_EDGES 65536
+#define PATH_FIND_NO_NODE u16_MAX
+
+struct PathFindClusters
+{
+    // Clusters cover the level, starting at grid cell (0, 0).
+    u32 num_clusters_x;
+    u32 num_clusters_y;
+
+    // Nodes are sorted by cluster.
+    u32 num_nodes;
+    u16 node_cell[MAX_PATH_FIND_NODES];
+    u16 cluster_first_node[MAX_PATH_FIND_CLUSTERS + 1];
+
+    // Edges of node i are [node_first_edge[i], node_first_edge[i + 1]).
+    u32 num_edges;
+    u32 node_first_edge[MAX_PATH_FIND_NODES + 1];
+    u16 edge_node[MAX_PATH_FIND_EDGES];
+    u32 edge_dist[MAX_PATH_FIND_EDGES];
+
+    // Node of each grid cell, or PATH_FIND_NO_NODE.
+    u16 grid_node[256 * 256];
+};
+
+// Next cell on a shortest path to 'goal_idx' from every cell of the level. Cells that cannot reach the goal are their
+// own next cell, like the goal itself. One field serves every search towards the same goal.
+struct FlowField
+{
+    u16 goal_idx;
+    u16 grid_next[256 * 256];
+};
+
+#define MAX_PATH_FIND_BATCH 256
+
+// One search of a run_path_find_batch, in level space like the arguments of run_path_find.
+struct PathFindRequest
+{
+    s32 start_x;
+    s32 start_y;
+    s32 end_x;
+    s32 end_y;
+};
+
+// State of a batch of searches that is run a little at a time, see start_path_find_batch.
+struct PathFindBatch
+{
+    enum PathFindMode mode;
+    u32 num_requests;
+    u16 start_idx[MAX_PATH_FIND_BATCH];
+    u16 end_idx[MAX_PATH_FIND_BATCH];
+
+    // Requests with a reachable end, sorted by end cell, then start cell.
+    u32 num_order;
+    u32 order_key[MAX_PATH_FIND_BATCH];
+    u16 order[MAX_PATH_FIND_BATCH];
+
+    // order[first, last) share the end searched from now. order[next] is the next request to get its path, and
+    // order[first, num_settled) the starts the shared search has settled so far.
+    u32 first;
+    u32 last;
+    u32 next;
+    u32 num_settled;
+    u8 is_shared;
+    u8 is_searching;
+    s32 target_box[4];
+};
+
+// Scratch memory for one 256x256 grid pathfind at a time. Walls come from the shared, read only WallGrid, so each
+// thread that runs path finds only needs its own PathFind.
 struct PathFind
 {
-    // 256x256 grid pathfind
+    // A cell has been visited by the current search iff its grid_search_id is search_id. grid_dist, grid_prev and
+    // grid_open_idx are only valid for visited cells, so starting a search does not have to reset them.
+    u32 search_id;
+    u32 grid_search_id[256 * 256];
 
-    // Bitarray of valid cells.
-    u8 grid[256 * 256 / 8 + 4];
     u32 grid_dist[256 * 256];
     u16 grid_prev[256 * 256];
+    // Index of the cell in the open list, or PATH_FIND_NOT_OPEN.
+    u32 grid_open_idx[256 * 256];
 
+    // 4-ary min heap on f_dist. Each cell is in it at most once.
     u32 num_open_list;
-    u16 open_list[65536 + 8];
-    u32 open_list_f_dist[65536 + 8];
+    u16 open_list[256 * 256];
+    u32 open_list_f_dist[256 * 256];
+
+    // The search in progress, see start_path_find.
+    enum PathFindMode mode;
+    u16 end_idx;
 };
 
 struct Level;
-void init_path_find(struct PathFind* path_find, const struct Level* level);
+void init_path_find(struct PathFind* path_find);
+
+// 'path_find' is only used as scratch.
+void init_path_find_clusters(
+    struct PathFindClusters* clusters,
+    struct PathFind* path_find,
+    const struct WallGrid* wall_grid,
+    const struct Level* level);
+
+// Brings 'clusters' up to date after the walls in the level space box [x, x + w) x [y, y + h) changed. Only the
+// clusters next to the box are searched again. 'scratch' holds the old graph meanwhile, and 'path_find' is only used
+// as scratch.
+void update_path_find_clusters(
+    struct PathFindClusters* clusters,
+    struct PathFindClusters* scratch,
+    struct PathFind* path_find,
+    const s32 x,
+    const s32 y,
+    const u32 w,
+    const u32 h,
+    const struct WallGrid* wall_grid,
+    const struct Level* level);
+
+// A search that can be advanced a few cells at a time, over several ticks if need be. Only A* and JPS can be
+// resumed. The search lives in 'path_find', so it must not be used for anything else until the search is done.
+// Returns 0 if there is no open end cell.
+u8 start_path_find(
+    struct PathFind* path_find,
+    const enum PathFindMode mode,
+    const struct WallGrid* wall_grid,
+    const struct Level* level,
+    const s32 start_x,
+    const s32 start_y,
+    const s32 end_x,
+    const s32 end_y);
+
+// Expands cells until about '*r_budget' work is spent, taking it off the budget. Work is one per cell expanded by
+// A*, and one per straight scan or diagonal step of JPS. An expansion that started within budget always finishes.
+enum PathFindStatus resume_path_find(struct PathFind* path_find, const struct WallGrid* wall_grid, u32* r_budget);
+
+// Once resume_path_find is done, writes the path in the same format as run_path_find.
+u32 get_path_find_result(const struct PathFind* path_find, s32* r_path_x, s32* r_path_y, const struct Level* level);
 
 u32 run_path_find(
     struct PathFind* path_find,
     s32* r_path_x,
     s32* r_path_y,
+    const struct WallGrid* wall_grid,
+    const struct Level* level,
+    const s32 start_x,
+    const s32 start_y,
+    const s32 end_x,
+    const s32 end_y);
+
+// Same result format as run_path_find, but searches with jump point search. Paths have the same length as
+// run_path_find's, though ties between equally short paths can be broken differently.
+u32 run_path_find_jps(
+    struct PathFind* path_find,
+    s32* r_path_x,
+    s32* r_path_y,
+    const struct WallGrid* wall_grid,
     const struct Level* level,
     const s32 start_x,
     const s32 start_y,
     const s32 end_x,
     const s32 end_y);
+
+// Hierarchical search over 'clusters', then refines only the first few abstract segments with run_path_find_jps. The
+// returned path starts like run_path_find's but may stop short of the end; call again as the path is used up.
+// Paths within one cluster are searched directly. Abstract paths are close to, but not always, the shortest.
+// Cannot be resumed; adds the work it spent to '*r_work', one per cell or abstract node expanded and as in
+// resume_path_find for the refining searches.
+u32 run_path_find_hpa(
+    struct PathFind* path_find,
+    u32* r_work,
+    s32* r_path_x,
+    s32* r_path_y,
+    const struct PathFindClusters* clusters,
+    const struct WallGrid* wall_grid,
+    const struct Level* level,
+    const s32 start_x,
+    const s32 start_y,
+    const s32 end_x,
+    const s32 end_y);
+
+// The grid cell, y * 256 + x, that searches towards the level space 'end_x', 'end_y' end in. Returns 0 if there is
+// none.
+u8 get_path_find_end_cell(
+    u16* r_cell_idx,
+    const struct WallGrid* wall_grid,
+    const struct Level* level,
+    const s32 end_x,
+    const s32 end_y);
+
+// Starts building the field towards 'goal_idx' with a Dijkstra search out of the goal. The search lives in
+// 'path_find' like a resumable search. Until it is done, walls may only change where path_find_reached_box says the
+// search has not got to yet.
+void start_flow_field_build(struct PathFind* path_find, const struct Level* level, const u16 goal_idx);
+
+// Returns 1 if the search in 'path_find' has visited a cell of the grid box [x0, x1) x [y0, y1) or next to it, so
+// that changing walls in the box may make its result wrong. Cells it has not got to are found as they are then.
+u8 path_find_reached_box(const struct PathFind* path_find, const s32 x0, const s32 y0, const s32 x1, const s32 y1);
+
+// Expands cells until '*r_budget' of them are done, taking them off the budget, one per cell. Once the search is
+// done, writes the whole field at once, so 'flow_field' keeps its old contents while the build is in progress.
+enum PathFindStatus resume_flow_field_build(
+    struct FlowField* flow_field,
+    struct PathFind* path_find,
+    const struct WallGrid* wall_grid,
+    const struct Level* level,
+    u32* r_budget);
+
+// Same result format as run_path_find, but only the first 'max_path_len' cells of the path, read from the field.
+u32 follow_flow_field(
+    const struct FlowField* flow_field,
+    s32* r_path_x,
+    s32* r_path_y,
+    const u32 max_path_len,
+    const struct WallGrid* wall_grid,
+    const struct Level* level,
+    const s32 start_x,
+    const s32 start_y);
+
+// Sets up many searches to be run by resume_path_find_batch. Requests whose ends fall on the same grid cell share one
+// Dijkstra search out of that cell, steered towards their starts and stopped once it has settled them all. With JPS
+// that only pays off for large groups, smaller ones get a JPS search each. Identical requests are searched once. Every
+// search runs out of the end. Clears r_path_len[0, num_requests).
+void start_path_find_batch(
+    struct PathFindBatch* batch,
+    u32* r_path_len,
+    const enum PathFindMode mode,
+    const struct PathFindRequest* requests,
+    const u32 num_requests,
+    const struct WallGrid* wall_grid,
+    const struct Level* level);
+
+// Runs the searches of 'batch' until '*r_budget' is used up, charged as in resume_path_find with one per cell a shared
+// search expands. Path i goes to r_path_x/r_path_y from i * max_path_len, r_path_len[i] cells long, in the format of
+// run_path_find but only its first 'max_path_len' cells. Paths are written as their searches finish, so the outputs
+// and 'path_find' must be left alone until PATH_FIND_STATUS_DONE, and the walls must not change.
+enum PathFindStatus resume_path_find_batch(
+    struct PathFindBatch* batch,
+    struct PathFind* path_find,
+    s32* r_path_x,
+    s32* r_path_y,
+    u32* r_path_len,
+    const u32 max_path_len,
+    const struct WallGrid* wall_grid,
+    const struct Level* level,
+    u32* r_budget);
+
+// Runs a whole batch in one call, see start_path_find_batch. Returns the work spent.
+u32 run_path_find_batch(
+    struct PathFind* path_find,
+    s32* r_path_x,
+    s32* r_path_y,
+    u32* r_path_len,
+    const u32 max_path_len,
+    const enum PathFindMode mode,
+    const struct PathFindRequest* requests,
+    const u32 num_requests,
+    const struct WallGrid* wall_grid,
+    const struct Level* level);
@@ -4,6 +4,26 @@
 
 f32 platform_get_screen_aspect_ratio();
 
+s64 platform_get_time_ns();
+
+// AVX2 and FMA are supported by both the cpu and the OS.
+u8 platform_cpu_has_avx2();
+
+// Logical processors available to the process.
+u32 platform_get_num_cpus();
+
+// Runs 'fn(data)' on a new thread. Threads are never joined; they run until the process exits.
+void platform_start_thread(void (*fn)(void* data), void* data);
+
+// Counting semaphore.
+struct PlatformSemaphore
+{
+    u64 handle;
+};
+void platform_init_semaphore(struct PlatformSemaphore* semaphore);
+void platform_signal_semaphore(struct PlatformSemaphore* semaphore, const u32 count);
+void platform_wait_semaphore(struct PlatformSemaphore* semaphore);
+
 struct PlayerInput;
 void platform_read_player_input(
     struct PlayerInput* player_input,
@@ -0,0 +1,644 @@
+#include "bullet_compact.h"
+#include "engine.h"
+#include "game_state.h"
+#include "level0.h"
+#include "math.h"
+
+#include "platform_linux/platform_linux_core.h"
+
+#include <linux/perf_event.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+// Usage: engine_bench [num_frames] [scenario|all|bullet_compact] [num_threads]
+// Runs every scenario (or only the named one) for num_frames ticks after a short warmup and prints one JSON object
+// per scenario on stdout. The simulation is deterministic, so 'checksum' must only change when the simulation does.
+// bullet_compact instead times each bullet compaction kernel, and the assign_bullet loop they replaced, num_frames times
+// per bullet count and survival rate.
+
+#define BENCH_WARMUP_FRAMES 60
+#define BENCH_MAX_FRAMES 100000
+// npc_doors shuts the next door this often.
+#define BENCH_DOOR_INTERVAL 30
+#define BENCH_NUM_DOORS 3
+
+enum BenchScenario
+{
+    BENCH_IDLE_32,
+    BENCH_PLAYERS_256,
+    BENCH_BULLET_STORM,
+    BENCH_NPC_CROSS_MAP,
+    BENCH_NPC_RALLY_256,
+    BENCH_NPC_DOORS,
+
+    NUM_BENCH_SCENARIOS
+};
+
+static const char* BENCH_SCENARIO_NAMES[NUM_BENCH_SCENARIOS] =
+{
+    "idle_32",
+    "players_256",
+    "bullet_storm",
+    "npc_cross_map",
+    "npc_rally_256",
+    "npc_doors",
+};
+
+static const char* ENGINE_PHASE_NAMES[NUM_ENGINE_PHASES] =
+{
+    "npc",
+    "physics",
+    "bullet_compact",
+};
+
+struct BenchPerf
+{
+    s32 fd_cycles;
+    s32 fd_instructions;
+};
+
+struct BenchMemory
+{
+    struct PlatformLinuxCore core;
+
+    // Outside the engine so it survives bench_init_scenario.
+    struct JobSystem job_system;
+
+    struct Engine engine;
+
+    // Targets re-applied before every tick so update_npc_target's periodic reroll does not change the scenario.
+    f32 npc_target_pos_x[MAX_PLAYERS];
+    f32 npc_target_pos_y[MAX_PLAYERS];
+
+    s64 tick_ns[BENCH_MAX_FRAMES];
+
+    // bullet_compact input, and the positions it compacts in place.
+    struct GameState compact_prev_game_state;
+    struct GameState compact_next_game_state;
+    f32 compact_pos_x[MAX_BULLETS];
+    f32 compact_pos_y[MAX_BULLETS];
+    u8 compact_is_dead[MAX_BULLETS];
+};
+struct BenchMemory* g_bench_memory;
+
+static struct GameState* bench_get_latest_game_state(struct Engine* engine)
+{
+    return &engine->game_states[(engine->cur_game_state_idx + 1) & 1];
+}
+
+static u8 bench_is_open_pos(const struct Level* level, const f32 x, const f32 y, const f32 margin)
+{
+    for(u64 i = 0; i < level->num_walls; i++)
+    {
+        const struct LevelWallGeometry* wall = &level->walls[i];
+        const u8 inside =
+            x > (f32)wall->x - margin &&
+            x < (f32)(wall->x + (s32)wall->w) + margin &&
+            y > (f32)wall->y - margin &&
+            y < (f32)(wall->y + (s32)wall->h) + margin;
+        if(inside)
+        {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+static void bench_set_player(
+    struct Engine* engine,
+    const u32 player_id,
+    const f32 pos_x,
+    const f32 pos_y,
+    const u8 team_id)
+{
+    for(u64 i = 0; i < ARRAY_COUNT(engine->game_states); i++)
+    {
+        struct GameState* game_state = &engine->game_states[i];
+        game_state->player_vel_x[player_id] = 0.0f;
+        game_state->player_vel_y[player_id] = 0.0f;
+        game_state->player_pos_x[player_id] = pos_x;
+        game_state->player_pos_y[player_id] = pos_y;
+        game_state->player_health[player_id] = 100;
+        game_state->player_type[player_id] = 0;
+        game_state->player_team_id[player_id] = team_id;
+    }
+}
+
+// Spreads MAX_PLAYERS players over the open cells of the level, blue on the left and red on the right.
+static u32 bench_spread_players(struct Engine* engine)
+{
+    u32 num = 0;
+    for(f32 y = (f32)LEVEL0_BOTTOM + 2.0f; y < (f32)LEVEL0_TOP - 2.0f && num < MAX_PLAYERS; y += 2.25f)
+    {
+        for(f32 x = (f32)LEVEL0_LEFT + 2.0f; x < (f32)LEVEL0_RIGHT - 2.0f && num < MAX_PLAYERS; x += 2.25f)
+        {
+            if(bench_is_open_pos(&LEVEL0, x, y, 1.0f))
+            {
+                bench_set_player(engine, num, x, y, x < 0.0f ? 0 : 1);
+                num++;
+            }
+        }
+    }
+    ASSERT(num == MAX_PLAYERS, "Not enough open cells for %u players.", MAX_PLAYERS);
+    for(u64 i = 0; i < ARRAY_COUNT(engine->game_states); i++)
+    {
+        engine->game_states[i].num_players = num;
+    }
+    engine->num_npcs = num;
+    return num;
+}
+
+static void bench_init_scenario(struct Engine* engine, const enum BenchScenario scenario)
+{
+    memset(engine, 0xCD, sizeof(*engine));
+    init_engine(engine, &g_bench_memory->job_system);
+
+    struct GameState* game_state = bench_get_latest_game_state(engine);
+
+    switch(scenario)
+    {
+        case BENCH_IDLE_32:
+        case BENCH_BULLET_STORM:
+        {
+            for(u32 i = 0; i < game_state->num_players; i++)
+            {
+                g_bench_memory->npc_target_pos_x[i] = game_state->player_pos_x[i];
+                g_bench_memory->npc_target_pos_y[i] = game_state->player_pos_y[i];
+            }
+        }
+        break;
+
+        case BENCH_PLAYERS_256:
+        {
+            const u32 num = bench_spread_players(engine);
+            for(u32 i = 0; i < num; i++)
+            {
+                g_bench_memory->npc_target_pos_x[i] = (f32)(rand_u32(i + 131) % LEVEL0_WIDTH) + (f32)LEVEL0_LEFT;
+                g_bench_memory->npc_target_pos_y[i] = (f32)(rand_u32(i + 277) % LEVEL0_HEIGHT) + (f32)LEVEL0_BOTTOM;
+            }
+        }
+        break;
+
+        case BENCH_NPC_CROSS_MAP:
+        {
+            // Everyone runs for the enemy flag.
+            for(u32 i = 0; i < game_state->num_players; i++)
+            {
+                const u32 enemy_team = game_state->player_team_id[i] ^ 1;
+                g_bench_memory->npc_target_pos_x[i] = LEVEL0.flag_pos_x[enemy_team] + (f32)(i % 4) - 1.5f;
+                g_bench_memory->npc_target_pos_y[i] = LEVEL0.flag_pos_y[enemy_team] + (f32)((i / 4) % 4) - 1.5f;
+            }
+        }
+        break;
+
+        case BENCH_NPC_DOORS:
+        case BENCH_NPC_RALLY_256:
+        {
+            // Every npc of a team runs for the same cell, the enemy flag.
+            const u32 num = bench_spread_players(engine);
+            for(u32 i = 0; i < num; i++)
+            {
+                const u32 enemy_team = game_state->player_team_id[i] ^ 1;
+                g_bench_memory->npc_target_pos_x[i] = LEVEL0.flag_pos_x[enemy_team];
+                g_bench_memory->npc_target_pos_y[i] = LEVEL0.flag_pos_y[enemy_team];
+            }
+        }
+        break;
+
+        default:
+        {
+            ASSERT(0, "Invalid scenario %u", (u32)scenario);
+        }
+        break;
+    }
+}
+
+static void bench_pre_tick(struct Engine* engine, const enum BenchScenario scenario, const u32 frame)
+{
+    struct GameState* game_state = bench_get_latest_game_state(engine);
+
+    for(u32 i = 0; i < game_state->num_players; i++)
+    {
+        engine->npcs[i].target_pos_x = g_bench_memory->npc_target_pos_x[i];
+        engine->npcs[i].target_pos_y = g_bench_memory->npc_target_pos_y[i];
+    }
+
+    if(scenario == BENCH_NPC_DOORS && frame % BENCH_DOOR_INTERVAL == 0)
+    {
+        // One door across the middle of the level is shut at a time, so the rallying npcs keep being rerouted.
+        const u32 door = (frame / BENCH_DOOR_INTERVAL) % BENCH_NUM_DOORS;
+        const u32 prev_door = (door + BENCH_NUM_DOORS - 1) % BENCH_NUM_DOORS;
+        const s32 door_h = (LEVEL0_HEIGHT + BENCH_NUM_DOORS - 1) / BENCH_NUM_DOORS;
+        set_engine_path_blocker(engine, -1, LEVEL0_BOTTOM + (s32)prev_door * door_h, 2, (u32)door_h, 0);
+        set_engine_path_blocker(engine, -1, LEVEL0_BOTTOM + (s32)door * door_h, 2, (u32)door_h, 1);
+    }
+
+    if(scenario == BENCH_BULLET_STORM)
+    {
+        // Keep the bullet arrays full. Bullets fly mostly vertically through the middle of the level so they die on
+        // the outer walls without reaching the idle players. Leave room for player 0 to shoot.
+        for(u32 i = game_state->num_bullets; i < MAX_BULLETS - 1; i++)
+        {
+            const u32 seed = frame * MAX_BULLETS + i;
+            const u32 r0 = rand_u32(seed * 3 + 1);
+            const u32 r1 = rand_u32(seed * 3 + 2);
+            const u32 r2 = rand_u32(seed * 3 + 3);
+            const f32 pos_x = (f32)(r0 % 2000) * 0.01f - 10.0f;
+            const f32 pos_y = (f32)(r1 % 5600) * 0.01f - 28.0f;
+            const f32 dir_x = (f32)(r2 % 1000) * 0.00034f - 0.17f;
+            const f32 dir_y = (r2 >> 16) & 1 ? 1.0f : -1.0f;
+            const v2 vel = scale_v2(normalize_v2(make_v2(dir_x, dir_y)), 400.0f);
+
+            add_engine_bullet(engine, vel.x, vel.y, pos_x, pos_y, (u8)(i & 1));
+        }
+    }
+}
+
+static u64 bench_hash(u64 h, const void* data, const u64 size)
+{
+    // FNV-1a
+    const u8* bytes = (const u8*)data;
+    for(u64 i = 0; i < size; i++)
+    {
+        h ^= bytes[i];
+        h *= 0x100000001B3ULL;
+    }
+    return h;
+}
+
+static u64 bench_checksum(struct Engine* engine)
+{
+    const struct GameState* game_state = bench_get_latest_game_state(engine);
+    const u64 num_players = game_state->num_players;
+    const u64 num_bullets = game_state->num_bullets;
+
+    u64 h = 0xCBF29CE484222325ULL;
+    h = bench_hash(h, &num_players, sizeof(num_players));
+    h = bench_hash(h, game_state->player_vel_x, num_players * sizeof(game_state->player_vel_x[0]));
+    h = bench_hash(h, game_state->player_vel_y, num_players * sizeof(game_state->player_vel_y[0]));
+    h = bench_hash(h, game_state->player_pos_x, num_players * sizeof(game_state->player_pos_x[0]));
+    h = bench_hash(h, game_state->player_pos_y, num_players * sizeof(game_state->player_pos_y[0]));
+    h = bench_hash(h, game_state->player_health, num_players * sizeof(game_state->player_health[0]));
+    h = bench_hash(h, &num_bullets, sizeof(num_bullets));
+    h = bench_hash(h, game_state->bullet_vel_x, num_bullets * sizeof(game_state->bullet_vel_x[0]));
+    h = bench_hash(h, game_state->bullet_vel_y, num_bullets * sizeof(game_state->bullet_vel_y[0]));
+    h = bench_hash(h, game_state->bullet_pos_x, num_bullets * sizeof(game_state->bullet_pos_x[0]));
+    h = bench_hash(h, game_state->bullet_pos_y, num_bullets * sizeof(game_state->bullet_pos_y[0]));
+    h = bench_hash(h, game_state->bullet_team_id, num_bullets * sizeof(game_state->bullet_team_id[0]));
+    return h;
+}
+
+static s32 bench_open_perf_counter(const u64 config)
+{
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.size = sizeof(attr);
+    attr.config = config;
+    attr.disabled = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    return (s32)syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+static void bench_init_perf(struct BenchPerf* perf)
+{
+    perf->fd_cycles = bench_open_perf_counter(PERF_COUNT_HW_CPU_CYCLES);
+    perf->fd_instructions = bench_open_perf_counter(PERF_COUNT_HW_INSTRUCTIONS);
+}
+
+static void bench_start_perf(const struct BenchPerf* perf)
+{
+    if(perf->fd_cycles >= 0)
+    {
+        ioctl(perf->fd_cycles, PERF_EVENT_IOC_RESET, 0);
+        ioctl(perf->fd_cycles, PERF_EVENT_IOC_ENABLE, 0);
+    }
+    if(perf->fd_instructions >= 0)
+    {
+        ioctl(perf->fd_instructions, PERF_EVENT_IOC_RESET, 0);
+        ioctl(perf->fd_instructions, PERF_EVENT_IOC_ENABLE, 0);
+    }
+}
+
+// Returns -1 if the counter is unavailable.
+static s64 bench_stop_perf(const s32 fd)
+{
+    if(fd < 0)
+    {
+        return -1;
+    }
+    ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
+    s64 count = 0;
+    if(read(fd, &count, sizeof(count)) != sizeof(count))
+    {
+        return -1;
+    }
+    return count;
+}
+
+static int bench_compare_s64(const void* a, const void* b)
+{
+    const s64 x = *(const s64*)a;
+    const s64 y = *(const s64*)b;
+    return (x > y) - (x < y);
+}
+
+static void bench_print_per_tick(const char* name, const s64 total, const u32 num_frames)
+{
+    if(total >= 0)
+    {
+        printf(", \"%s\": %.1f", name, (f64)total / (f64)num_frames);
+    }
+    else
+    {
+        printf(", \"%s\": null", name);
+    }
+}
+
+static void bench_run_scenario(const enum BenchScenario scenario, const u32 num_frames, const struct BenchPerf* perf)
+{
+    struct Engine* engine = &g_bench_memory->engine;
+    s64* tick_ns = g_bench_memory->tick_ns;
+
+    bench_init_scenario(engine, scenario);
+
+    for(u32 frame = 0; frame < BENCH_WARMUP_FRAMES; frame++)
+    {
+        bench_pre_tick(engine, scenario, frame);
+        tick_engine(engine);
+    }
+
+    s64 phase_ns[NUM_ENGINE_PHASES] = {0};
+    s64 total_ns = 0;
+    u64 total_sub_steps = 0;
+
+    bench_start_perf(perf);
+    for(u32 frame = 0; frame < num_frames; frame++)
+    {
+        bench_pre_tick(engine, scenario, BENCH_WARMUP_FRAMES + frame);
+
+        const s64 start_ns = platform_linux_get_time_ns();
+        tick_engine(engine);
+        tick_ns[frame] = platform_linux_get_time_ns() - start_ns;
+
+        total_ns += tick_ns[frame];
+        for(u64 i = 0; i < NUM_ENGINE_PHASES; i++)
+        {
+            phase_ns[i] += engine->phase_ns[i];
+        }
+        total_sub_steps += engine->physics_num_sub_steps;
+    }
+    const s64 cycles = bench_stop_perf(perf->fd_cycles);
+    const s64 instructions = bench_stop_perf(perf->fd_instructions);
+
+    const u64 checksum = bench_checksum(engine);
+
+    qsort(tick_ns, num_frames, sizeof(tick_ns[0]), bench_compare_s64);
+
+    printf("{\"scenario\": \"%s\"", BENCH_SCENARIO_NAMES[scenario]);
+    printf(", \"frames\": %u", num_frames);
+    printf(", \"ns_per_tick_mean\": %.1f", (f64)total_ns / (f64)num_frames);
+    printf(", \"ns_per_tick_p50\": %lli", (long long)tick_ns[num_frames / 2]);
+    printf(", \"ns_per_tick_p99\": %lli", (long long)tick_ns[(u64)num_frames * 99 / 100]);
+    printf(", \"ns_per_tick_max\": %lli", (long long)tick_ns[num_frames - 1]);
+    printf(", \"phase_ns_mean\": {");
+    for(u64 i = 0; i < NUM_ENGINE_PHASES; i++)
+    {
+        printf("%s\"%s\": %.1f", i ? ", " : "", ENGINE_PHASE_NAMES[i], (f64)phase_ns[i] / (f64)num_frames);
+    }
+    printf("}");
+    printf(", \"sub_steps_mean\": %.2f", (f64)total_sub_steps / (f64)num_frames);
+    bench_print_per_tick("cycles_per_tick", cycles, num_frames);
+    bench_print_per_tick("instructions_per_tick", instructions, num_frames);
+    if(cycles > 0 && instructions >= 0)
+    {
+        printf(", \"ipc\": %.3f", (f64)instructions / (f64)cycles);
+    }
+    else
+    {
+        printf(", \"ipc\": null");
+    }
+    printf(", \"checksum\": \"%016llx\"}\n", (unsigned long long)checksum);
+    fflush(stdout);
+}
+
+typedef u32 (*BenchCompactFn)(struct GameState*, const struct GameState*, const u8*, const u32);
+
+// The engine's bullet setter, kept here for the baseline below.
+static void bench_assign_bullet(
+    struct GameState* game_state,
+    const u64 idx,
+    const f32 vel_x,
+    const f32 vel_y,
+    const f32 pos_x,
+    const f32 pos_y,
+    const f32 prev_pos_x,
+    const f32 prev_pos_y,
+    const f32 wall_hit_time,
+    const u8 team_id)
+{
+    game_state->bullet_vel_x[idx] = vel_x;
+    game_state->bullet_vel_y[idx] = vel_y;
+    game_state->bullet_pos_x[idx] = pos_x;
+    game_state->bullet_pos_y[idx] = pos_y;
+    game_state->bullet_prev_pos_x[idx] = prev_pos_x;
+    game_state->bullet_prev_pos_y[idx] = prev_pos_y;
+    game_state->bullet_wall_hit_time[idx] = wall_hit_time;
+    game_state->bullet_team_id[idx] = team_id;
+}
+
+// Baseline: the loop tick_engine removed dead bullets with before the compaction kernels, which sets each survivor
+// through assign_bullet.
+static u32 bench_compact_bullets_assign(
+    struct GameState* next_game_state,
+    const struct GameState* prev_game_state,
+    const u8* bullet_is_dead,
+    const u32 num_bullets)
+{
+    const f32 frame_dt = (f32)FRAME_DURATION_NS * (1.0f / 1000000000.0f);
+    u64 i_dst = 0;
+    for(u64 i_src = 0; i_src < num_bullets; i_src++)
+    {
+        if(!bullet_is_dead[i_src])
+        {
+            bench_assign_bullet(
+                next_game_state,
+                i_dst,
+                prev_game_state->bullet_vel_x[i_src],
+                prev_game_state->bullet_vel_y[i_src],
+                next_game_state->bullet_pos_x[i_src],
+                next_game_state->bullet_pos_y[i_src],
+                prev_game_state->bullet_pos_x[i_src],
+                prev_game_state->bullet_pos_y[i_src],
+                prev_game_state->bullet_wall_hit_time[i_src] - frame_dt,
+                prev_game_state->bullet_team_id[i_src]
+            );
+            i_dst++;
+        }
+    }
+    return (u32)i_dst;
+}
+
+static void bench_run_bullet_compact(const u32 num_calls)
+{
+    static const u32 NUM_BULLETS[] = {1024, 8192};
+    static const u32 SURVIVAL_PCT[] = {1, 50, 99};
+
+    // The first kernel is the reference the others must match.
+    static const char* KERNEL_NAMES[] =
+    {
+        "assign_loop",
+        "scalar",
+        "avx2",
+#ifdef __AVX512F__
+        "avx512",
+#endif
+    };
+    static const BenchCompactFn KERNELS[] =
+    {
+        bench_compact_bullets_assign,
+        compact_bullets_scalar,
+        compact_bullets_avx2,
+#ifdef __AVX512F__
+        compact_bullets_avx512,
+#endif
+    };
+
+    struct GameState* prev_game_state = &g_bench_memory->compact_prev_game_state;
+    struct GameState* next_game_state = &g_bench_memory->compact_next_game_state;
+    s64* call_ns = g_bench_memory->tick_ns;
+
+    for(u32 i_num = 0; i_num < ARRAY_COUNT(NUM_BULLETS); i_num++)
+    {
+        for(u32 i_pct = 0; i_pct < ARRAY_COUNT(SURVIVAL_PCT); i_pct++)
+        {
+            const u32 num_bullets = NUM_BULLETS[i_num];
+
+            // Deterministic inputs with distinct values, so any misplaced element changes the checksum.
+            u64 rng = 0x9E3779B97F4A7C15ULL ^ ((u64)num_bullets << 8) ^ SURVIVAL_PCT[i_pct];
+            for(u32 i = 0; i < num_bullets; i++)
+            {
+                rng = rng * 6364136223846793005ULL + 1442695040888963407ULL;
+                g_bench_memory->compact_is_dead[i] = (rng >> 33) % 100 >= SURVIVAL_PCT[i_pct];
+                prev_game_state->bullet_vel_x[i] = (f32)i;
+                prev_game_state->bullet_vel_y[i] = (f32)i + 0.25f;
+                prev_game_state->bullet_pos_x[i] = (f32)i + 0.5f;
+                prev_game_state->bullet_pos_y[i] = (f32)i + 0.75f;
+                prev_game_state->bullet_team_id[i] = (u8)i;
+                prev_game_state->bullet_wall_hit_time[i] = (f32)i * 0.001f;
+                g_bench_memory->compact_pos_x[i] = -(f32)i;
+                g_bench_memory->compact_pos_y[i] = -(f32)i - 0.5f;
+            }
+
+            u64 expected_checksum = 0;
+            for(u32 i_kernel = 0; i_kernel < ARRAY_COUNT(KERNELS); i_kernel++)
+            {
+                s64 total_ns = 0;
+                u32 num_kept = 0;
+                for(u32 i_call = 0; i_call < num_calls; i_call++)
+                {
+                    COPY(next_game_state->bullet_pos_x, g_bench_memory->compact_pos_x, num_bullets);
+                    COPY(next_game_state->bullet_pos_y, g_bench_memory->compact_pos_y, num_bullets);
+
+                    const s64 start_ns = platform_linux_get_time_ns();
+                    num_kept = KERNELS[i_kernel](next_game_state, prev_game_state, g_bench_memory->compact_is_dead, num_bullets);
+                    call_ns[i_call] = platform_linux_get_time_ns() - start_ns;
+                    total_ns += call_ns[i_call];
+                }
+
+                u64 h = 0xCBF29CE484222325ULL;
+                h = bench_hash(h, &num_kept, sizeof(num_kept));
+                h = bench_hash(h, next_game_state->bullet_vel_x, num_kept * sizeof(next_game_state->bullet_vel_x[0]));
+                h = bench_hash(h, next_game_state->bullet_vel_y, num_kept * sizeof(next_game_state->bullet_vel_y[0]));
+                h = bench_hash(h, next_game_state->bullet_pos_x, num_kept * sizeof(next_game_state->bullet_pos_x[0]));
+                h = bench_hash(h, next_game_state->bullet_pos_y, num_kept * sizeof(next_game_state->bullet_pos_y[0]));
+                h = bench_hash(h, next_game_state->bullet_prev_pos_x, num_kept * sizeof(next_game_state->bullet_prev_pos_x[0]));
+                h = bench_hash(h, next_game_state->bullet_prev_pos_y, num_kept * sizeof(next_game_state->bullet_prev_pos_y[0]));
+                h = bench_hash(h, next_game_state->bullet_wall_hit_time, num_kept * sizeof(next_game_state->bullet_wall_hit_time[0]));
+                h = bench_hash(h, next_game_state->bullet_team_id, num_kept * sizeof(next_game_state->bullet_team_id[0]));
+                expected_checksum = i_kernel == 0 ? h : expected_checksum;
+                ASSERT(h == expected_checksum, "Bullet compaction kernel '%s' disagrees with the assign_bullet loop.", KERNEL_NAMES[i_kernel]);
+
+                qsort(call_ns, num_calls, sizeof(call_ns[0]), bench_compare_s64);
+
+                printf("{\"bench\": \"bullet_compact\"");
+                printf(", \"kernel\": \"%s\"", KERNEL_NAMES[i_kernel]);
+                printf(", \"bullets\": %u", num_bullets);
+                printf(", \"survival_pct\": %u", SURVIVAL_PCT[i_pct]);
+                printf(", \"calls\": %u", num_calls);
+                printf(", \"ns_per_call_mean\": %.1f", (f64)total_ns / (f64)num_calls);
+                printf(", \"ns_per_call_p50\": %lli", (long long)call_ns[num_calls / 2]);
+                printf(", \"ns_per_bullet_p50\": %.3f", (f64)call_ns[num_calls / 2] / (f64)num_bullets);
+                printf(", \"checksum\": \"%016llx\"}\n", (unsigned long long)h);
+                fflush(stdout);
+            }
+        }
+    }
+}
+
+int main(int argc, char** argv)
+{
+    const s64 num_frames = argc > 1 ? strtoll(argv[1], NULL, 10) : 600;
+    ASSERT(num_frames > 0 && num_frames <= BENCH_MAX_FRAMES, "Frame count must be in [1, %u].", BENCH_MAX_FRAMES);
+
+    u32 scenario_mask = u32_MAX;
+    const u8 run_bullet_compact = argc > 2 && strcmp(argv[2], "bullet_compact") == 0;
+    if(run_bullet_compact)
+    {
+        scenario_mask = 0;
+    }
+    else if(argc > 2 && strcmp(argv[2], "all") != 0)
+    {
+        scenario_mask = 0;
+        for(u32 i = 0; i < NUM_BENCH_SCENARIOS; i++)
+        {
+            scenario_mask |= strcmp(argv[2], BENCH_SCENARIO_NAMES[i]) == 0 ? (1U << i) : 0;
+        }
+        ASSERT(scenario_mask, "Unknown scenario '%s'.", argv[2]);
+    }
+
+    void* mem = mmap(
+        NULL,
+        (sizeof(struct BenchMemory) + 4095) & ~4095,
+        PROT_READ | PROT_WRITE,
+        MAP_PRIVATE | MAP_ANONYMOUS,
+        -1,
+        0);
+    ASSERT(mem != MAP_FAILED, "Could not allocate memory.");
+    g_bench_memory = mem;
+
+    platform_linux_init_core(&g_bench_memory->core);
+
+    // Threads default to one per cpu. The checksums must not depend on it.
+    const s64 num_threads =
+        argc > 3
+        ? strtoll(argv[3], NULL, 10)
+        : (s64)min_u32(platform_get_num_cpus(), JOB_SYSTEM_MAX_THREADS);
+    ASSERT(num_threads >= 1 && num_threads <= JOB_SYSTEM_MAX_THREADS, "Thread count must be in [1, %u].", JOB_SYSTEM_MAX_THREADS);
+    init_job_system(&g_bench_memory->job_system, (u32)num_threads);
+
+    if(run_bullet_compact)
+    {
+        bench_run_bullet_compact((u32)num_frames);
+        return 0;
+    }
+
+    struct BenchPerf perf;
+    bench_init_perf(&perf);
+
+    for(u32 i = 0; i < NUM_BENCH_SCENARIOS; i++)
+    {
+        if(scenario_mask & (1U << i))
+        {
+            bench_run_scenario((enum BenchScenario)i, (u32)num_frames, &perf);
+        }
+    }
+
+    return 0;
+}
@@ -0,0 +1,185 @@
+#include "platform.h"
+#include "game_input.h"
+
+#include "platform_linux/platform_linux_core.h"
+
+#include <cpuid.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+struct PlatformLinuxCore* g_platform_linux_core;
+
+void assert_fn(const u64 c, const char* msg, ...)
+{
+    if(!c)
+    {
+        va_list args;
+        va_start(args, msg);
+        fprintf(stderr, "Assertion failed: ");
+        vfprintf(stderr, msg, args);
+        fprintf(stderr, "\n");
+        va_end(args);
+        fflush(stderr);
+        abort();
+    }
+}
+
+struct PlatformLinuxCore* platform_linux_get_core()
+{
+    return g_platform_linux_core;
+}
+
+void platform_linux_init_core(struct PlatformLinuxCore* mem)
+{
+    g_platform_linux_core = mem;
+
+    struct PlatformLinuxCore* linux_core = platform_linux_get_core();
+
+    // Match a 1920x1080 window so cursor math in the engine behaves like the win32 build.
+    linux_core->screen_aspect_ratio = 1080.0f / 1920.0f;
+
+    memset(&linux_core->player_input, 0, sizeof(linux_core->player_input));
+
+    const long num_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    linux_core->num_cpus = num_cpus > 0 ? (u32)num_cpus : 1;
+}
+
+s64 platform_linux_get_time_ns()
+{
+    struct timespec ts;
+    const s32 ret = clock_gettime(CLOCK_MONOTONIC, &ts);
+    ASSERT(ret == 0, "clock_gettime failed.");
+    return (s64)ts.tv_sec * 1000000000LL + (s64)ts.tv_nsec;
+}
+
+void platform_linux_set_player_input(const struct PlayerInput* player_input)
+{
+    struct PlatformLinuxCore* linux_core = platform_linux_get_core();
+    linux_core->player_input = *player_input;
+}
+
+s64 platform_get_time_ns()
+{
+    return platform_linux_get_time_ns();
+}
+
+u8 platform_cpu_has_avx2()
+{
+    u32 eax, ebx, ecx, edx;
+    if(!__get_cpuid(1, &eax, &ebx, &ecx, &edx))
+    {
+        return 0;
+    }
+    const u8 has_osxsave = (ecx >> 27) & 1;
+    const u8 has_avx = (ecx >> 28) & 1;
+    const u8 has_fma = (ecx >> 12) & 1;
+    if(!has_osxsave || !has_avx || !has_fma)
+    {
+        return 0;
+    }
+
+    // OS saves the ymm registers.
+    if((_xgetbv(0) & 6) != 6)
+    {
+        return 0;
+    }
+
+    if(!__get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx))
+    {
+        return 0;
+    }
+    return (ebx >> 5) & 1;
+}
+
+u32 platform_get_num_cpus()
+{
+    const struct PlatformLinuxCore* linux_core = platform_linux_get_core();
+
+    return linux_core->num_cpus;
+}
+
+struct PlatformLinuxThread
+{
+    void (*fn)(void* data);
+    void* data;
+};
+
+static void* platform_linux_thread_proc(void* param)
+{
+    const struct PlatformLinuxThread* thread = param;
+    thread->fn(thread->data);
+    return NULL;
+}
+
+void platform_start_thread(void (*fn)(void* data), void* data)
+{
+    static struct PlatformLinuxThread threads[64];
+    static u32 num_threads = 0;
+    ASSERT(num_threads < ARRAY_COUNT(threads), "Too many threads.");
+
+    struct PlatformLinuxThread* thread = &threads[num_threads++];
+    thread->fn = fn;
+    thread->data = data;
+    pthread_t handle;
+    const s32 ret = pthread_create(&handle, NULL, platform_linux_thread_proc, thread);
+    ASSERT(ret == 0, "pthread_create failed: %i", ret);
+    pthread_detach(handle);
+}
+
+void platform_init_semaphore(struct PlatformSemaphore* semaphore)
+{
+    sem_t* sem = malloc(sizeof(sem_t));
+    ASSERT(sem, "Could not allocate semaphore.");
+    const s32 ret = sem_init(sem, 0, 0);
+    ASSERT(ret == 0, "sem_init failed.");
+    semaphore->handle = (u64)sem;
+}
+
+void platform_signal_semaphore(struct PlatformSemaphore* semaphore, const u32 count)
+{
+    for(u32 i = 0; i < count; i++)
+    {
+        sem_post((sem_t*)semaphore->handle);
+    }
+}
+
+void platform_wait_semaphore(struct PlatformSemaphore* semaphore)
+{
+    while(sem_wait((sem_t*)semaphore->handle) != 0)
+    {
+        // Interrupted by a signal.
+    }
+}
+
+f32 platform_get_screen_aspect_ratio()
+{
+    const struct PlatformLinuxCore* linux_core = platform_linux_get_core();
+
+    return linux_core->screen_aspect_ratio;
+}
+
+void platform_read_player_input(
+    struct PlayerInput* player_input,
+    const f32 cam_pos_x,
+    const f32 cam_pos_y,
+    const f32 cam_width,
+    const f32 cam_aspect_ratio,
+    const f32 player_pos_x,
+    const f32 player_pos_y)
+{
+    const struct PlatformLinuxCore* linux_core = platform_linux_get_core();
+
+    (void)cam_pos_x;
+    (void)cam_pos_y;
+    (void)cam_width;
+    (void)cam_aspect_ratio;
+    (void)player_pos_x;
+    (void)player_pos_y;
+
+    *player_input = linux_core->player_input;
+}
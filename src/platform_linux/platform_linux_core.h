@@ -0,0 +1,23 @@
+#pragma once
+
+#include "common.h"
+#include "game_input.h"
+
+// Headless platform layer. There is no window or input device, so the player 0 input is whatever was last
+// handed to platform_linux_set_player_input (zeroed by default).
+struct PlatformLinuxCore
+{
+    f32 screen_aspect_ratio;
+
+    // Reported by platform_get_num_cpus. Defaults to the online cpu count, can be overridden after init.
+    u32 num_cpus;
+
+    struct PlayerInput player_input;
+};
+
+struct PlatformLinuxCore* platform_linux_get_core();
+void platform_linux_init_core(struct PlatformLinuxCore* mem);
+s64 platform_linux_get_time_ns();
+
+// Input returned by the next calls to platform_read_player_input. The cursor is in world space.
+void platform_linux_set_player_input(const struct PlayerInput* player_input);
@@ -0,0 +1,81 @@
+#include "engine.h"
+#include "math.h"
+
+#include "platform_linux/platform_linux_core.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+
+struct PlatformLinux
+{
+    struct PlatformLinuxCore core;
+};
+
+struct MainMemory
+{
+    struct PlatformLinux platform;
+
+    struct JobSystem job_system;
+
+    struct Engine engine;
+};
+struct MainMemory* g_main_memory;
+
+void platform_linux_init()
+{
+    platform_linux_init_core(&g_main_memory->platform.core);
+}
+
+// Usage: engine_headless [num_frames]
+// Runs tick_engine back to back with no frame pacing. Runs forever if num_frames is 0 or omitted.
+int main(int argc, char** argv)
+{
+    const s64 num_frames = argc > 1 ? strtoll(argv[1], NULL, 10) : 0;
+    ASSERT(num_frames >= 0, "Invalid frame count %lli", (long long)num_frames);
+
+    void* mem = mmap(
+        NULL,
+        (sizeof(struct MainMemory) + 4095) & ~4095,
+        PROT_READ | PROT_WRITE,
+        MAP_PRIVATE | MAP_ANONYMOUS,
+        -1,
+        0);
+    ASSERT(mem != MAP_FAILED, "Could not allocate memory.");
+    g_main_memory = mem;
+    ASSERT(((u64)g_main_memory & 4095) == 0, "g_main_memory not aligned.");
+    memset(g_main_memory, 0xCD, sizeof(*g_main_memory));
+
+    platform_linux_init();
+    init_job_system(&g_main_memory->job_system, min_u32(platform_get_num_cpus(), JOB_SYSTEM_MAX_THREADS));
+    init_engine(&g_main_memory->engine, &g_main_memory->job_system);
+
+    const s64 start_ns = platform_linux_get_time_ns();
+    s64 report_ns = start_ns;
+    s64 report_frame = 0;
+    for(s64 frame = 0; num_frames == 0 || frame < num_frames; frame++)
+    {
+        tick_engine(&g_main_memory->engine);
+
+        const s64 now_ns = platform_linux_get_time_ns();
+        if(now_ns - report_ns >= 1000000000LL)
+        {
+            const s64 n = frame + 1 - report_frame;
+            printf("frame %lli: %.1f ticks/s, %.0f ns/tick\n",
+                   (long long)(frame + 1),
+                   (f64)n * 1e9 / (f64)(now_ns - report_ns),
+                   (f64)(now_ns - report_ns) / (f64)n);
+            fflush(stdout);
+            report_ns = now_ns;
+            report_frame = frame + 1;
+        }
+    }
+
+    const s64 total_ns = platform_linux_get_time_ns() - start_ns;
+    printf("%lli frames in %.3f s, %.0f ns/tick\n",
+           (long long)num_frames,
+           (f64)total_ns * 1e-9,
+           num_frames ? (f64)total_ns / (f64)num_frames : 0.0);
+
+    return 0;
+}
@@ -5,6 +5,7 @@
 #include "platform_win32/platform_win32_input.h"
 
 #include <stdarg.h>
+#include <intrin.h>
 
 #define STB_SPRINTF_IMPLEMENTATION
 #include "external/stb_sprintf.h"
@@ -244,6 +245,89 @@ s64 platform_win32_get_time_ns()
     return cy.QuadPart * (1000000000LL / win32_core->clock_freq_hz);
 }
 
+s64 platform_get_time_ns()
+{
+    return platform_win32_get_time_ns();
+}
+
+u8 platform_cpu_has_avx2()
+{
+    s32 regs[4];
+    __cpuid(regs, 1);
+    const u8 has_osxsave = (regs[2] >> 27) & 1;
+    const u8 has_avx = (regs[2] >> 28) & 1;
+    const u8 has_fma = (regs[2] >> 12) & 1;
+    if(!has_osxsave || !has_avx || !has_fma)
+    {
+        return 0;
+    }
+
+    // OS saves the ymm registers.
+    if((_xgetbv(0) & 6) != 6)
+    {
+        return 0;
+    }
+
+    __cpuidex(regs, 7, 0);
+    return (regs[1] >> 5) & 1;
+}
+
+u32 platform_get_num_cpus()
+{
+    SYSTEM_INFO system_info;
+    GetSystemInfo(&system_info);
+    return system_info.dwNumberOfProcessors;
+}
+
+struct PlatformWin32Thread
+{
+    void (*fn)(void* data);
+    void* data;
+};
+
+static DWORD WINAPI platform_win32_thread_proc(LPVOID param)
+{
+    const struct PlatformWin32Thread* thread = param;
+    thread->fn(thread->data);
+    return 0;
+}
+
+void platform_start_thread(void (*fn)(void* data), void* data)
+{
+    static struct PlatformWin32Thread threads[64];
+    static u32 num_threads = 0;
+    ASSERT(num_threads < ARRAY_COUNT(threads), "Too many threads.");
+
+    struct PlatformWin32Thread* thread = &threads[num_threads++];
+    thread->fn = fn;
+    thread->data = data;
+    const HANDLE handle = CreateThread(NULL, 0, platform_win32_thread_proc, thread, 0, NULL);
+    ASSERT(handle, "CreateThread failed: %i", GetLastError());
+    CloseHandle(handle);
+}
+
+void platform_init_semaphore(struct PlatformSemaphore* semaphore)
+{
+    const HANDLE handle = CreateSemaphore(NULL, 0, 0x7FFFFFFF, NULL);
+    ASSERT(handle, "CreateSemaphore failed: %i", GetLastError());
+    semaphore->handle = (u64)handle;
+}
+
+void platform_signal_semaphore(struct PlatformSemaphore* semaphore, const u32 count)
+{
+    if(count)
+    {
+        const BOOL success = ReleaseSemaphore((HANDLE)semaphore->handle, count, NULL);
+        ASSERT(success, "ReleaseSemaphore failed: %i", GetLastError());
+    }
+}
+
+void platform_wait_semaphore(struct PlatformSemaphore* semaphore)
+{
+    const DWORD result = WaitForSingleObject((HANDLE)semaphore->handle, INFINITE);
+    ASSERT(result == WAIT_OBJECT_0, "WaitForSingleObject failed: %i", GetLastError());
+}
+
 f32 platform_get_screen_aspect_ratio()
 {
     const struct PlatformWin32Core* win32_core = platform_win32_get_core();
@@ -1,5 +1,6 @@
 
 #include "engine.h"
+#include "math.h"
 
 #include "platform_win32/platform_win32_core.h"
 #include "platform_win32/platform_win32_input.h"
@@ -18,6 +19,8 @@ struct MainMemory
 {
     struct PlatformWin32 win32;
 
+    struct JobSystem job_system;
+
     struct Engine engine;
 };
 struct MainMemory* g_main_memory;
@@ -43,7 +46,8 @@ void WinMainCRTStartup()
     memset(g_main_memory, 0xCD, sizeof(*g_main_memory));
 
     platform_win32_init();
-    init_engine(&g_main_memory->engine);
+    init_job_system(&g_main_memory->job_system, min_u32(platform_get_num_cpus(), JOB_SYSTEM_MAX_THREADS));
+    init_engine(&g_main_memory->engine, &g_main_memory->job_system);
 
     s64 frame_timer_ns = 0;
     s64 last_frame_time_ns = platform_win32_get_time_ns();
@@ -0,0 +1,359 @@
+#include "wall_grid.h"
+#include "level.h"
+#include "math.h"
+
+static inline u8 is_wall_cell(const struct WallGrid* wall_grid, const s32 x, const s32 y)
+{
+    if(x < 0 || x >= 256 || y < 0 || y >= 256)
+    {
+        return 1;
+    }
+    const u64 idx = (u64)y * 256ULL + (u64)x;
+    const u64 byte = idx / 8;
+    const u64 bit = idx % 8;
+    return (wall_grid->grid[byte] & (1ULL << bit)) != 0;
+}
+
+static inline u32 get_clearance(const struct WallGrid* wall_grid, const s32 x, const s32 y)
+{
+    return x < 0 || x >= 256 || y < 0 || y >= 256 ? 0 : wall_grid->clearance[y * 256 + x];
+}
+
+void init_wall_grid(struct WallGrid* wall_grid, const struct Level* level)
+{
+    ZERO_ARRAY(wall_grid->grid);
+    ZERO_ARRAY(wall_grid->grid_transposed);
+
+    wall_grid->origin_x = -(s32)(level->width / 2);
+    wall_grid->origin_y = -(s32)(level->height / 2);
+
+    for(u64 i = 0; i < level->num_walls; i++)
+    {
+        const struct LevelWallGeometry* wall = &level->walls[i];
+        const s32 gx0 = clamp_s32(wall->x - wall_grid->origin_x,                   0, 256);
+        const s32 gx1 = clamp_s32(wall->x + (s32)wall->w - wall_grid->origin_x,    0, 256);
+        const s32 gy0 = clamp_s32(wall->y - wall_grid->origin_y,                   0, 256);
+        const s32 gy1 = clamp_s32(wall->y + (s32)wall->h - wall_grid->origin_y,    0, 256);
+
+        for(s32 y = gy0; y < gy1; y++)
+        {
+            for(s32 x = gx0; x < gx1; x++)
+            {
+                const u64 idx = (u64)y * 256ULL + (u64)x;
+                wall_grid->grid[idx / 8] |= 1ULL << (idx % 8);
+                const u64 idx_transposed = (u64)x * 256ULL + (u64)y;
+                wall_grid->grid_transposed[idx_transposed / 8] |= 1ULL << (idx_transposed % 8);
+            }
+        }
+    }
+
+    // Chebyshev distance transform: a forward and a backward pass over the 8 neighbors is exact. Outside the grid
+    // is solid.
+    for(s32 y = 0; y < 256; y++)
+    {
+        for(s32 x = 0; x < 256; x++)
+        {
+            u32 c = 0;
+            if(!is_wall_cell(wall_grid, x, y))
+            {
+                c = 1 + min_u32(
+                    min_u32(get_clearance(wall_grid, x - 1, y - 1), get_clearance(wall_grid, x, y - 1)),
+                    min_u32(get_clearance(wall_grid, x + 1, y - 1), get_clearance(wall_grid, x - 1, y)));
+            }
+            wall_grid->clearance[y * 256 + x] = (u8)min_u32(c, u8_MAX);
+        }
+    }
+    for(s32 y = 255; y >= 0; y--)
+    {
+        for(s32 x = 255; x >= 0; x--)
+        {
+            const u32 c = 1 + min_u32(
+                min_u32(get_clearance(wall_grid, x + 1, y + 1), get_clearance(wall_grid, x, y + 1)),
+                min_u32(get_clearance(wall_grid, x - 1, y + 1), get_clearance(wall_grid, x + 1, y)));
+            wall_grid->clearance[y * 256 + x] = (u8)min_u32(wall_grid->clearance[y * 256 + x], c);
+        }
+    }
+
+    wall_grid->max_clearance = 0;
+    for(u64 i = 0; i < ARRAY_COUNT(wall_grid->clearance); i++)
+    {
+        wall_grid->max_clearance = max_u8(wall_grid->max_clearance, wall_grid->clearance[i]);
+    }
+
+    wall_grid->num_walls = level->num_walls;
+    for(u64 i = 0; i < level->num_walls; i++)
+    {
+        const struct LevelWallGeometry* wall = &level->walls[i];
+        wall_grid->wall_min_x[i] = (f32)wall->x;
+        wall_grid->wall_min_y[i] = (f32)wall->y;
+        wall_grid->wall_max_x[i] = (f32)(wall->x + (s32)wall->w);
+        wall_grid->wall_max_y[i] = (f32)(wall->y + (s32)wall->h);
+    }
+}
+
+// Returns 1 if the grid cell is in one of the level's walls.
+static u8 is_level_wall_cell(const struct WallGrid* wall_grid, const s32 x, const s32 y)
+{
+    const f32 level_x = (f32)(x + wall_grid->origin_x);
+    const f32 level_y = (f32)(y + wall_grid->origin_y);
+    for(u32 i = 0; i < wall_grid->num_walls; i++)
+    {
+        if(level_x >= wall_grid->wall_min_x[i] && level_x < wall_grid->wall_max_x[i] &&
+           level_y >= wall_grid->wall_min_y[i] && level_y < wall_grid->wall_max_y[i])
+        {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// Clearance of an open cell found by looking for walls on the rings around it, knowing there are none closer than
+// 'min_dist'.
+static u8 find_clearance(const struct WallGrid* wall_grid, const s32 x, const s32 y, const s32 min_dist)
+{
+    for(s32 d = min_dist; d < u8_MAX; d++)
+    {
+        for(s32 i = -d; i <= d; i++)
+        {
+            if(is_wall_cell(wall_grid, x + i, y - d) ||
+               is_wall_cell(wall_grid, x + i, y + d) ||
+               is_wall_cell(wall_grid, x - d, y + i) ||
+               is_wall_cell(wall_grid, x + d, y + i))
+            {
+                return (u8)d;
+            }
+        }
+    }
+    return u8_MAX;
+}
+
+void set_wall_grid_cells(
+    struct WallGrid* wall_grid,
+    const s32 x,
+    const s32 y,
+    const u32 w,
+    const u32 h,
+    const u8 is_wall)
+{
+    const s32 gx0 = clamp_s32(x - wall_grid->origin_x,            0, 256);
+    const s32 gx1 = clamp_s32(x + (s32)w - wall_grid->origin_x,   0, 256);
+    const s32 gy0 = clamp_s32(y - wall_grid->origin_y,            0, 256);
+    const s32 gy1 = clamp_s32(y + (s32)h - wall_grid->origin_y,   0, 256);
+    if(gx0 >= gx1 || gy0 >= gy1)
+    {
+        return;
+    }
+
+    for(s32 cy = gy0; cy < gy1; cy++)
+    {
+        for(s32 cx = gx0; cx < gx1; cx++)
+        {
+            const u64 idx = (u64)cy * 256ULL + (u64)cx;
+            const u64 idx_transposed = (u64)cx * 256ULL + (u64)cy;
+            if(is_wall || is_level_wall_cell(wall_grid, cx, cy))
+            {
+                wall_grid->grid[idx / 8] |= 1ULL << (idx % 8);
+                wall_grid->grid_transposed[idx_transposed / 8] |= 1ULL << (idx_transposed % 8);
+            }
+            else
+            {
+                wall_grid->grid[idx / 8] &= ~(1ULL << (idx % 8));
+                wall_grid->grid_transposed[idx_transposed / 8] &= ~(1ULL << (idx_transposed % 8));
+            }
+        }
+    }
+
+    // A cell further from the box than its clearance has a closer wall elsewhere, so only cells within max_clearance
+    // of the box can change. New walls can only bring the nearest wall closer. Opened cells can only move it away from
+    // cells whose nearest wall may have been in the box, and those are searched again.
+    const s32 reach = wall_grid->max_clearance;
+    for(s32 cy = max_s32(gy0 - reach, 0); cy < min_s32(gy1 + reach, 256); cy++)
+    {
+        for(s32 cx = max_s32(gx0 - reach, 0); cx < min_s32(gx1 + reach, 256); cx++)
+        {
+            const u32 dist = (u32)max_s32(
+                max_s32(gx0 - cx, cx - (gx1 - 1)),
+                max_s32(max_s32(gy0 - cy, cy - (gy1 - 1)), 0));
+            u8* clearance = &wall_grid->clearance[cy * 256 + cx];
+            if(is_wall)
+            {
+                *clearance = (u8)min_u32(*clearance, dist);
+            }
+            else if(*clearance >= dist && !is_wall_cell(wall_grid, cx, cy))
+            {
+                *clearance = find_clearance(wall_grid, cx, cy, max_s32(*clearance, 1));
+                wall_grid->max_clearance = max_u8(wall_grid->max_clearance, *clearance);
+            }
+        }
+    }
+}
+
+// Slab test of the segment from 'a' along 'd', t in [0, 1], against the box.
+// Clips the ray parameter range [*t_min, *t_max] of a + d * t to the box. Returns 0 if nothing of it is left.
+u8 is_wall_grid_cell(const struct WallGrid* wall_grid, const s32 x, const s32 y)
+{
+    return is_wall_cell(wall_grid, x - wall_grid->origin_x, y - wall_grid->origin_y);
+}
+
+static u8 clip_ray_to_box(
+    const f32 a_x,
+    const f32 a_y,
+    const f32 d_x,
+    const f32 d_y,
+    const f32 min_x,
+    const f32 min_y,
+    const f32 max_x,
+    const f32 max_y,
+    f32* t_min,
+    f32* t_max)
+{
+    const f32 a[2] = { a_x, a_y };
+    const f32 d[2] = { d_x, d_y };
+    const f32 box_min[2] = { min_x, min_y };
+    const f32 box_max[2] = { max_x, max_y };
+    for(u32 i = 0; i < 2; i++)
+    {
+        if(d[i] == 0.0f)
+        {
+            if(a[i] < box_min[i] || a[i] > box_max[i])
+            {
+                return 0;
+            }
+            continue;
+        }
+        const f32 inv_d = 1.0f / d[i];
+        const f32 t0 = (box_min[i] - a[i]) * inv_d;
+        const f32 t1 = (box_max[i] - a[i]) * inv_d;
+        *t_min = max_f32(*t_min, min_f32(t0, t1));
+        *t_max = min_f32(*t_max, max_f32(t0, t1));
+        if(*t_min > *t_max)
+        {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+static u8 segment_hits_box(
+    const f32 a_x,
+    const f32 a_y,
+    const f32 d_x,
+    const f32 d_y,
+    const f32 min_x,
+    const f32 min_y,
+    const f32 max_x,
+    const f32 max_y)
+{
+    f32 t_min = 0.0f;
+    f32 t_max = 1.0f;
+    return clip_ray_to_box(a_x, a_y, d_x, d_y, min_x, min_y, max_x, max_y, &t_min, &t_max);
+}
+
+u8 wall_grid_intersect_circle_sweep(
+    const struct WallGrid* wall_grid,
+    const f32 a_x,
+    const f32 a_y,
+    const f32 b_x,
+    const f32 b_y,
+    const f32 radius)
+{
+    // Grid space.
+    const f32 ax = a_x - (f32)wall_grid->origin_x;
+    const f32 ay = a_y - (f32)wall_grid->origin_y;
+    const f32 bx = b_x - (f32)wall_grid->origin_x;
+    const f32 by = b_y - (f32)wall_grid->origin_y;
+    const f32 dx = bx - ax;
+    const f32 dy = by - ay;
+
+    // DDA over the cells crossed by the segment. t_max is the segment parameter where we cross the next cell boundary
+    // and t_delta is the parameter distance between boundaries. Only cells that close to a wall need their neighborhood
+    // tested against the circle.
+    const s32 reach = (s32)round_pos_inf(radius);
+    s32 cell_x = (s32)round_neg_inf(ax);
+    s32 cell_y = (s32)round_neg_inf(ay);
+    const s32 end_x = (s32)round_neg_inf(bx);
+    const s32 end_y = (s32)round_neg_inf(by);
+    const s32 step_x = dx > 0.0f ? 1 : -1;
+    const s32 step_y = dy > 0.0f ? 1 : -1;
+    const f32 t_delta_x = dx != 0.0f ? abs_f32(1.0f / dx) : INFINITY;
+    const f32 t_delta_y = dy != 0.0f ? abs_f32(1.0f / dy) : INFINITY;
+    f32 t_max_x = dx != 0.0f ? (dx > 0.0f ? (f32)(cell_x + 1) - ax : ax - (f32)cell_x) * t_delta_x : INFINITY;
+    f32 t_max_y = dy != 0.0f ? (dy > 0.0f ? (f32)(cell_y + 1) - ay : ay - (f32)cell_y) * t_delta_y : INFINITY;
+
+    // Always finish in the end cell even if float error steers the walk.
+    const s32 num_steps = abs_s32(end_x - cell_x) + abs_s32(end_y - cell_y);
+    for(s32 i = 0; i <= num_steps; i++)
+    {
+        if((f32)get_clearance(wall_grid, cell_x, cell_y) - 1.0f < radius)
+        {
+            for(s32 y = cell_y - reach; y <= cell_y + reach; y++)
+            {
+                for(s32 x = cell_x - reach; x <= cell_x + reach; x++)
+                {
+                    if(is_wall_cell(wall_grid, x, y) &&
+                       segment_hits_box(
+                           ax,
+                           ay,
+                           dx,
+                           dy,
+                           (f32)x - radius,
+                           (f32)y - radius,
+                           (f32)(x + 1) + radius,
+                           (f32)(y + 1) + radius))
+                    {
+                        return 1;
+                    }
+                }
+            }
+        }
+
+        if(i == num_steps)
+        {
+            break;
+        }
+        const u8 step_in_x = cell_x != end_x && (t_max_x < t_max_y || cell_y == end_y);
+        if(step_in_x)
+        {
+            cell_x += step_x;
+            t_max_x += t_delta_x;
+        }
+        else
+        {
+            cell_y += step_y;
+            t_max_y += t_delta_y;
+        }
+    }
+
+    return 0;
+}
+
+f32 get_wall_box_time_of_impact(
+    const struct WallGrid* wall_grid,
+    const f32 pos_x,
+    const f32 pos_y,
+    const f32 vel_x,
+    const f32 vel_y)
+{
+    // Only boxes hit before the best so far can improve on it.
+    f32 t_impact = INFINITY;
+    for(u32 i_wall = 0; i_wall < wall_grid->num_walls; i_wall++)
+    {
+        f32 t_min = 0.0f;
+        f32 t_max = t_impact;
+        if(clip_ray_to_box(
+               pos_x,
+               pos_y,
+               vel_x,
+               vel_y,
+               wall_grid->wall_min_x[i_wall],
+               wall_grid->wall_min_y[i_wall],
+               wall_grid->wall_max_x[i_wall],
+               wall_grid->wall_max_y[i_wall],
+               &t_min,
+               &t_max))
+        {
+            t_impact = t_min;
+        }
+    }
+    return t_impact;
+}
@@ -0,0 +1,66 @@
+#pragma once
+
+#include "common.h"
+#include "level.h"
+
+// 256x256 occupancy bitgrid of level walls with 1x1 cells: cell (0, 0) is the bottom left corner of the level.
+// Everything outside the grid is solid. Shared by the physics and every thread's path finds.
+struct WallGrid
+{
+    s32 origin_x;
+    s32 origin_y;
+
+    // Bitarray of wall cells. Padded so 32-bit gathers at any byte stay in bounds.
+    u8 grid[256 * 256 / 8 + 4];
+    // Same bits with x and y swapped, so columns can be scanned a word at a time too.
+    u8 grid_transposed[256 * 256 / 8];
+
+    // Chebyshev distance in cells from each cell to the nearest wall cell, 0 for walls. Every point of a cell with
+    // clearance c is at least c - 1 away from any wall.
+    u8 clearance[256 * 256];
+    // At least the largest clearance, which bounds how far a change to the walls can reach.
+    u8 max_clearance;
+
+    // Wall boxes as min and max corners.
+    u32 num_walls;
+    f32 wall_min_x[MAX_LEVEL_WALLS];
+    f32 wall_min_y[MAX_LEVEL_WALLS];
+    f32 wall_max_x[MAX_LEVEL_WALLS];
+    f32 wall_max_y[MAX_LEVEL_WALLS];
+};
+
+void init_wall_grid(struct WallGrid* wall_grid, const struct Level* level);
+
+// Turns the cells of the level space box [x, x + w) x [y, y + h) into walls, or opens them again except where the
+// level has walls, and updates the clearance of the cells near them. Only the cells change: the wall boxes the physics
+// collides with stay the level's.
+void set_wall_grid_cells(
+    struct WallGrid* wall_grid,
+    const s32 x,
+    const s32 y,
+    const u32 w,
+    const u32 h,
+    const u8 is_wall);
+
+// Returns 1 if the level space cell (x, y) is a wall cell, including cells set by set_wall_grid_cells.
+u8 is_wall_grid_cell(const struct WallGrid* wall_grid, const s32 x, const s32 y);
+
+// Returns 1 if a circle of 'radius' moving from (a_x, a_y) to (b_x, b_y) may touch a wall cell. Conservative near
+// wall corners, which are tested as square.
+u8 wall_grid_intersect_circle_sweep(
+    const struct WallGrid* wall_grid,
+    const f32 a_x,
+    const f32 a_y,
+    const f32 b_x,
+    const f32 b_y,
+    const f32 radius);
+
+// Returns the time until a point starting at (pos_x, pos_y) and moving at (vel_x, vel_y) first touches one of the wall
+// boxes, 0 if it starts in one, or INFINITY if it never does. Like the physics, ignores cells set by
+// set_wall_grid_cells.
+f32 get_wall_box_time_of_impact(
+    const struct WallGrid* wall_grid,
+    const f32 pos_x,
+    const f32 pos_y,
+    const f32 vel_x,
+    const f32 vel_y);